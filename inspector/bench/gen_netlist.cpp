@@ -0,0 +1,206 @@
+// Deterministic generator of synthetic gate-level style netlists for benchmarking the inspector.
+//
+// The design is a balanced hierarchy: bench_top instantiates `fanout` copies of level_1, which
+// instantiates `fanout` copies of level_2, and so on; the deepest level instantiates `fanout`
+// macros. The fanout is chosen so that fanout^depth is as close as possible to the requested
+// instance count. Each macro type has a fixed set of ports; a fraction of the types is left
+// without a definition so they elaborate as blackboxes (UninstantiatedDefSymbol).
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+struct GeneratorOptions {
+    uint64_t instances = 1000;
+    int depth = 1;
+    int ports = 8;
+    int maxWidth = 32;
+    int macroTypes = 16;
+    double blackboxRatio = 0.5;
+    uint64_t seed = 1;
+    std::string outPath = "-";
+};
+
+// xorshift64*: small, fast and identical on every platform, so a given seed always produces the
+// same file.
+class Random {
+public:
+    explicit Random(uint64_t seed) : state(seed ? seed : 0x9E3779B97F4A7C15ull) {}
+
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1Dull;
+    }
+
+    int range(int lo, int hi) { return lo + static_cast<int>(next() % uint64_t(hi - lo + 1)); }
+
+private:
+    uint64_t state;
+};
+
+struct MacroPort {
+    std::string name;
+    bool output = false;
+    int width = 1;
+};
+
+struct MacroType {
+    std::string name;
+    bool blackbox = false;
+    std::vector<MacroPort> ports;
+};
+
+std::vector<MacroType> makeMacroTypes(const GeneratorOptions& opts, Random& rng) {
+    std::vector<MacroType> types(opts.macroTypes);
+    int blackboxes = static_cast<int>(std::lround(opts.blackboxRatio * opts.macroTypes));
+    for (int t = 0; t < opts.macroTypes; t++) {
+        auto& type = types[t];
+        type.name = "MACRO_" + std::to_string(t);
+        type.blackbox = t < blackboxes;
+        type.ports.push_back({"CLK", false, 1});
+        for (int p = 1; p < opts.ports; p++) {
+            bool output = p % 3 == 0;
+            type.ports.push_back({(output ? "Q" : "D") + std::to_string(p), output,
+                                  rng.range(1, opts.maxWidth)});
+        }
+    }
+    return types;
+}
+
+std::string rangeText(int width) {
+    return width > 1 ? "[" + std::to_string(width - 1) + ":0] " : "";
+}
+
+void writeMacroDefinitions(std::ostream& out, const std::vector<MacroType>& types) {
+    for (const auto& type : types) {
+        if (type.blackbox)
+            continue;
+        out << "module " << type.name << " (\n";
+        for (size_t p = 0; p < type.ports.size(); p++) {
+            const auto& port = type.ports[p];
+            out << "    " << (port.output ? "output " : "input ") << rangeText(port.width)
+                << port.name << (p + 1 < type.ports.size() ? ",\n" : "\n");
+        }
+        out << ");\nendmodule\n\n";
+    }
+}
+
+// The leaf level: `fanout` macros, each with its own nets.
+void writeLeafModule(std::ostream& out, std::string_view name, uint64_t fanout,
+                     const std::vector<MacroType>& types, Random& rng) {
+    out << "module " << name << " (input clk);\n";
+    std::vector<const MacroType*> chosen(fanout);
+    for (uint64_t i = 0; i < fanout; i++) {
+        chosen[i] = &types[rng.next() % types.size()];
+        for (size_t p = 1; p < chosen[i]->ports.size(); p++) {
+            const auto& port = chosen[i]->ports[p];
+            out << "    wire " << rangeText(port.width) << "n" << i << "_" << p << ";\n";
+        }
+    }
+    for (uint64_t i = 0; i < fanout; i++) {
+        out << "    " << chosen[i]->name << " u_macro_" << i << " (\n        .CLK(clk)";
+        for (size_t p = 1; p < chosen[i]->ports.size(); p++)
+            out << ",\n        ." << chosen[i]->ports[p].name << "(n" << i << "_" << p << ")";
+        out << "\n    );\n";
+    }
+    out << "endmodule\n\n";
+}
+
+void writeHierModule(std::ostream& out, std::string_view name, std::string_view child,
+                     uint64_t fanout) {
+    out << "module " << name << " (input clk);\n";
+    for (uint64_t i = 0; i < fanout; i++)
+        out << "    " << child << " u_" << child << "_" << i << " (.clk(clk));\n";
+    out << "endmodule\n\n";
+}
+
+uint64_t chooseFanout(uint64_t instances, int depth) {
+    auto fanout = static_cast<uint64_t>(
+        std::llround(std::pow(static_cast<double>(instances), 1.0 / depth)));
+    return fanout ? fanout : 1;
+}
+
+bool parseArgs(int argc, char** argv, GeneratorOptions& opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "-h" || arg == "--help" || i + 1 >= argc)
+            return false;
+
+        const char* value = argv[++i];
+        if (arg == "--instances")
+            opts.instances = std::strtoull(value, nullptr, 10);
+        else if (arg == "--depth")
+            opts.depth = std::atoi(value);
+        else if (arg == "--ports")
+            opts.ports = std::atoi(value);
+        else if (arg == "--width")
+            opts.maxWidth = std::atoi(value);
+        else if (arg == "--macros")
+            opts.macroTypes = std::atoi(value);
+        else if (arg == "--blackbox-ratio")
+            opts.blackboxRatio = std::atof(value);
+        else if (arg == "--seed")
+            opts.seed = std::strtoull(value, nullptr, 10);
+        else if (arg == "--out")
+            opts.outPath = value;
+        else
+            return false;
+    }
+    return opts.instances > 0 && opts.depth > 0 && opts.ports > 0 && opts.maxWidth > 0 &&
+           opts.macroTypes > 0 && opts.blackboxRatio >= 0 && opts.blackboxRatio <= 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    GeneratorOptions opts;
+    if (!parseArgs(argc, argv, opts)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--instances N] [--depth D] [--ports P] [--width W] [--macros M]"
+                     " [--blackbox-ratio R] [--seed S] [--out <file>|-]"
+                  << '\n';
+        return 1;
+    }
+
+    std::ofstream file;
+    std::vector<char> buffer(1 << 20);
+    if (opts.outPath != "-") {
+        file.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        file.open(opts.outPath);
+        if (!file) {
+            std::cerr << "Error: cannot write '" << opts.outPath << "'" << '\n';
+            return 1;
+        }
+    }
+    std::ostream& out = opts.outPath == "-" ? std::cout : file;
+
+    Random rng(opts.seed);
+    auto types = makeMacroTypes(opts, rng);
+    uint64_t fanout = chooseFanout(opts.instances, opts.depth);
+
+    uint64_t macros = 1;
+    for (int d = 0; d < opts.depth; d++)
+        macros *= fanout;
+    out << "// gen_netlist: " << macros << " macro instances, depth " << opts.depth << ", fanout "
+        << fanout << ", seed " << opts.seed << "\n\n";
+
+    writeMacroDefinitions(out, types);
+    auto levelName = [&](int d) {
+        return d == 0 ? std::string("bench_top") : "level_" + std::to_string(d);
+    };
+    writeLeafModule(out, levelName(opts.depth - 1), fanout, types, rng);
+    for (int d = opts.depth - 2; d >= 0; d--)
+        writeHierModule(out, levelName(d), levelName(d + 1), fanout);
+
+    out.flush();
+    return out ? 0 : 1;
+}
@@ -0,0 +1,223 @@
+"""Benchmark harness for the inspector.
+
+Generates synthetic netlists of increasing size with gen_netlist, runs the inspector on each with
+--stats, and records the per-phase timings in a JSON file. Given --compare, the new results are
+checked against an earlier file and the script fails if any phase got slower than the tolerance.
+"""
+
+import argparse
+import json
+import os
+import platform
+import subprocess
+import sys
+import tempfile
+import time
+
+DEFAULT_SIZES = [1_000, 10_000, 100_000, 1_000_000, 10_000_000]
+
+# Phases shorter than this in the baseline are too noisy to compare.
+MIN_COMPARABLE_SECONDS = 0.05
+
+
+def positive_int(text):
+    value = int(text)
+    if value < 1:
+        raise argparse.ArgumentTypeError(f"must be at least 1, got {value}")
+    return value
+
+
+def git_commit():
+    try:
+        proc = subprocess.run(
+            ["git", "rev-parse", "HEAD"],
+            cwd=os.path.dirname(os.path.abspath(__file__)),
+            check=True,
+            stdout=subprocess.PIPE,
+            stderr=subprocess.DEVNULL,
+            text=True,
+        )
+        return proc.stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def generate(generator, size, args, path):
+    cmd = [
+        generator,
+        "--instances",
+        str(size),
+        "--depth",
+        str(args.depth),
+        "--ports",
+        str(args.ports),
+        "--width",
+        str(args.width),
+        "--macros",
+        str(args.macros),
+        "--blackbox-ratio",
+        str(args.blackbox_ratio),
+        "--seed",
+        str(args.seed),
+        "--out",
+        path,
+    ]
+    subprocess.run(cmd, check=True)
+
+
+def run_once(inspector, netlist, extra_args, stats_path):
+    cmd = [
+        inspector,
+        netlist,
+        "--query",
+        "bench_top",
+        "--query",
+        "MACRO_*",
+        "--format",
+        "json",
+        "--out",
+        os.devnull,
+        f"--stats={stats_path}",
+        *extra_args,
+    ]
+    start = time.perf_counter()
+    subprocess.run(cmd, check=True, stdout=subprocess.DEVNULL)
+    wall = time.perf_counter() - start
+    with open(stats_path, "r") as f:
+        stats = json.load(f)
+    stats["process"] = wall
+    return stats
+
+
+def phase_times(stats):
+    return {phase["name"]: phase["wall"] for phase in stats.get("phases", [])}
+
+
+def bench_size(args, size, workdir):
+    netlist = os.path.join(workdir, f"bench_{size}.v")
+    stats_path = os.path.join(workdir, "stats.json")
+    generate(args.generator, size, args, netlist)
+
+    # Keep the fastest of the repeats for each phase; the minimum is the least noisy estimate.
+    best = {}
+    peak_rss = 0
+    for _ in range(args.repeat):
+        stats = run_once(args.inspector, netlist, args.inspector_arg, stats_path)
+        times = phase_times(stats)
+        times["process"] = stats["process"]
+        for name, seconds in times.items():
+            best[name] = min(seconds, best.get(name, seconds))
+        peak_rss = max(peak_rss, stats.get("peakRssBytes", 0))
+
+    entry = {
+        "instances": size,
+        "bytes": os.path.getsize(netlist),
+        "phases": best,
+        "counters": stats.get("counters", {}),
+        "peakRssBytes": peak_rss,
+    }
+    if not args.keep:
+        os.remove(netlist)
+    return entry
+
+
+def compare(results, baseline, tolerance):
+    """Return a list of human readable regressions against a baseline results file."""
+    base_by_size = {entry["instances"]: entry for entry in baseline.get("results", [])}
+    regressions = []
+    for entry in results:
+        base = base_by_size.get(entry["instances"])
+        if not base:
+            continue
+        for name, seconds in entry["phases"].items():
+            before = base["phases"].get(name)
+            if before is None or before < MIN_COMPARABLE_SECONDS:
+                continue
+            if seconds > before * (1 + tolerance):
+                regressions.append(
+                    f"{entry['instances']} instances, {name}: {before:.3f}s -> {seconds:.3f}s"
+                )
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark the inspector.")
+    parser.add_argument("--inspector", required=True, help="inspector executable")
+    parser.add_argument("--generator", required=True, help="gen_netlist executable")
+    parser.add_argument(
+        "--sizes",
+        default=",".join(str(size) for size in DEFAULT_SIZES),
+        help="Comma separated instance counts",
+    )
+    parser.add_argument("--depth", type=int, default=1, help="Hierarchy depth")
+    parser.add_argument("--ports", type=int, default=8, help="Ports per macro")
+    parser.add_argument("--width", type=int, default=32, help="Maximum bus width")
+    parser.add_argument("--macros", type=int, default=16, help="Number of macro types")
+    parser.add_argument(
+        "--blackbox-ratio",
+        type=float,
+        default=0.5,
+        help="Fraction of macro types left undefined",
+    )
+    parser.add_argument("--seed", type=int, default=1, help="Generator seed")
+    parser.add_argument("--repeat", type=positive_int, default=3, help="Runs per size")
+    parser.add_argument(
+        "--inspector-arg",
+        action="append",
+        default=[],
+        help="Extra argument passed to the inspector (repeatable)",
+    )
+    parser.add_argument("--out", default="bench.json", help="Results file")
+    parser.add_argument("--compare", help="Baseline results file to check against")
+    parser.add_argument(
+        "--tolerance",
+        type=float,
+        default=0.2,
+        help="Allowed slowdown per phase relative to the baseline",
+    )
+    parser.add_argument("--keep", action="store_true", help="Keep generated netlists")
+    parser.add_argument("--workdir", help="Directory for generated netlists")
+    args = parser.parse_args()
+
+    sizes = [int(size) for size in args.sizes.split(",") if size]
+    workdir = args.workdir or tempfile.mkdtemp(prefix="inspector-bench-")
+    os.makedirs(workdir, exist_ok=True)
+
+    results = []
+    for size in sizes:
+        entry = bench_size(args, size, workdir)
+        phases = ", ".join(f"{k} {v:.3f}s" for k, v in entry["phases"].items())
+        print(f"{size:>10} instances: {phases}")
+        results.append(entry)
+
+    report = {
+        "commit": git_commit(),
+        "host": platform.node(),
+        "config": {
+            "depth": args.depth,
+            "ports": args.ports,
+            "width": args.width,
+            "macros": args.macros,
+            "blackboxRatio": args.blackbox_ratio,
+            "seed": args.seed,
+            "repeat": args.repeat,
+            "inspectorArgs": args.inspector_arg,
+        },
+        "results": results,
+    }
+    with open(args.out, "w") as f:
+        json.dump(report, f, indent=2)
+    print(f"Results written to {args.out}")
+
+    if args.compare:
+        with open(args.compare, "r") as f:
+            baseline = json.load(f)
+        regressions = compare(results, baseline, args.tolerance)
+        for regression in regressions:
+            print(f"Regression: {regression}")
+        if regressions:
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,214 @@
+// Python module over the inspector core. A Design is parsed and elaborated once and then
+// queried in-process: results come back as Python objects (or plain dicts via to_dict()), so
+// there is no process spawn, re-elaboration or serialization per query.
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Inspector.h"
+
+namespace py = pybind11;
+
+namespace {
+
+py::dict toDict(const PortInfo& port) {
+    py::dict d;
+    d["name"] = port.name;
+    d["direction"] = port.direction;
+    d["type"] = port.type;
+    return d;
+}
+
+py::dict toDict(const ConnectionInfo& conn) {
+    py::dict d;
+    d["portName"] = conn.portName;
+    d["signalType"] = conn.signalType;
+    d["width"] = conn.width;
+    d["direction"] = conn.direction;
+    d["isConnected"] = conn.isConnected;
+    return d;
+}
+
+py::dict toDict(const InstanceInfo& info);
+
+template<typename T>
+py::list toList(const std::vector<T>& items) {
+    py::list list;
+    for (const auto& item : items)
+        list.append(toDict(item));
+    return list;
+}
+
+py::dict toDict(const InstanceInfo& info) {
+    py::dict d;
+    d["instanceName"] = info.instanceName;
+    d["fullPath"] = info.fullPath;
+    d["definitionName"] = info.definitionName;
+    d["connections"] = toList(info.connections);
+    d["startOffset"] = info.startOffset;
+    d["endOffset"] = info.endOffset;
+    return d;
+}
+
+py::dict toDict(const DefinitionInfo& def) {
+    py::dict d;
+    d["name"] = def.name;
+    d["ports"] = toList(def.ports);
+    d["instances"] = toList(def.instances);
+    return d;
+}
+
+// Same shape as the inspector's JSON output.
+py::dict toDict(const InspectorResult& result) {
+    py::dict d;
+    d["definition"] = py::none();
+    if (result.definition)
+        d["definition"] = toDict(*result.definition);
+    d["instances"] = toList(result.instances);
+    return d;
+}
+
+// A design loaded from inspector-style arguments: sources, -f filelists, include dirs, defines,
+// --top, --threads, ... Queries are serialized by a mutex (a Compilation must not be queried
+// concurrently) and run without the GIL. Before each query the sources are checked and the
+// design is re-elaborated if one of them changed, as in --serve.
+class Design {
+public:
+    Design(std::vector<std::string> args, std::vector<std::string> liberty,
+           std::optional<std::string> fields, std::optional<std::string> scope) :
+        args(std::move(args)) {
+        if (fields) {
+            auto parsed = FieldSet::parse(*fields);
+            if (!parsed)
+                throw py::value_error("unknown field in '" + *fields + "'");
+            collect.fields = *parsed;
+        }
+        if (!liberty.empty()) {
+            std::string error;
+            if (!libertyDb.load(liberty, defaultCacheDir(), error))
+                throw std::runtime_error(error);
+            collect.liberty = &libertyDb;
+        }
+        collect.scope = scope.value_or("");
+        load();
+    }
+
+    std::vector<InspectorResult> query(const std::vector<std::string>& names, bool instances) {
+        std::lock_guard lock(mutex);
+        if (sourcesChanged(design.sources))
+            load();
+        CollectOptions options = collect;
+        options.instances = instances;
+        return runQueries(*design.compilation, names, nullptr, options);
+    }
+
+    void reload() {
+        std::lock_guard lock(mutex);
+        load();
+    }
+
+private:
+    std::vector<std::string> args;
+    LibertyDatabase libertyDb;
+    CollectOptions collect;
+    LoadedDesign design;
+    std::mutex mutex;
+
+    void load() {
+        auto driver = std::make_unique<slang::driver::Driver>();
+        driver->addStandardArgs();
+
+        std::vector<const char*> argv = {"slang_inspector"};
+        for (const auto& arg : args)
+            argv.push_back(arg.c_str());
+        if (!driver->parseCommandLine(static_cast<int>(argv.size()), argv.data()))
+            throw py::value_error("invalid design arguments");
+
+        LoadedDesign fresh;
+        if (!elaborateDesign(std::move(driver), fresh))
+            throw std::runtime_error("failed to load design");
+        fresh.sources = stampInputs(argv, fresh.driver->sourceManager);
+        if (!collect.scope.empty() && !findScope(*fresh.compilation, collect.scope))
+            throw py::value_error("no instance at scope '" + collect.scope + "'");
+
+        // As in the executable: an explicit --threads N (N != 1) parallelises collection, except
+        // within a scope.
+        collect.threads = 1;
+        if (auto numThreads = fresh.driver->options.numThreads;
+            numThreads && *numThreads != 1 && collect.scope.empty()) {
+            collect.threads = *numThreads ? *numThreads : std::thread::hardware_concurrency();
+            prepareParallelCollection(*fresh.compilation);
+        }
+
+        // Drop the old compilation before the driver that owns its sources.
+        design.compilation.reset();
+        design = std::move(fresh);
+    }
+};
+
+} // namespace
+
+PYBIND11_MODULE(slang_inspector, m) {
+    m.doc() = "In-process module/definition queries over a slang design";
+
+    py::class_<PortInfo>(m, "PortInfo")
+        .def_readonly("name", &PortInfo::name)
+        .def_readonly("direction", &PortInfo::direction)
+        .def_readonly("type", &PortInfo::type)
+        .def("to_dict", py::overload_cast<const PortInfo&>(&toDict));
+
+    py::class_<ConnectionInfo>(m, "ConnectionInfo")
+        .def_readonly("port_name", &ConnectionInfo::portName)
+        .def_readonly("signal_type", &ConnectionInfo::signalType)
+        .def_readonly("width", &ConnectionInfo::width)
+        .def_readonly("direction", &ConnectionInfo::direction)
+        .def_readonly("is_connected", &ConnectionInfo::isConnected)
+        .def("to_dict", py::overload_cast<const ConnectionInfo&>(&toDict));
+
+    py::class_<InstanceInfo>(m, "InstanceInfo")
+        .def_readonly("instance_name", &InstanceInfo::instanceName)
+        .def_readonly("full_path", &InstanceInfo::fullPath)
+        .def_readonly("definition_name", &InstanceInfo::definitionName)
+        .def_readonly("connections", &InstanceInfo::connections)
+        .def_readonly("start_offset", &InstanceInfo::startOffset)
+        .def_readonly("end_offset", &InstanceInfo::endOffset)
+        .def("to_dict", py::overload_cast<const InstanceInfo&>(&toDict));
+
+    py::class_<DefinitionInfo>(m, "DefinitionInfo")
+        .def_readonly("name", &DefinitionInfo::name)
+        .def_readonly("ports", &DefinitionInfo::ports)
+        .def_readonly("instances", &DefinitionInfo::instances)
+        .def("to_dict", py::overload_cast<const DefinitionInfo&>(&toDict));
+
+    py::class_<InspectorResult>(m, "InspectorResult")
+        .def_readonly("definition", &InspectorResult::definition)
+        .def_readonly("instances", &InspectorResult::instances)
+        .def("to_dict", py::overload_cast<const InspectorResult&>(&toDict));
+
+    py::class_<Design>(m, "Design")
+        .def(py::init<std::vector<std::string>, std::vector<std::string>,
+                      std::optional<std::string>, std::optional<std::string>>(),
+             py::arg("args"), py::arg("liberty") = std::vector<std::string>(),
+             py::arg("fields") = py::none(), py::arg("scope") = py::none(),
+             py::call_guard<py::gil_scoped_release>(),
+             "Parses and elaborates the design named by inspector-style arguments")
+        .def("query", &Design::query, py::arg("names"), py::arg("instances") = true,
+             py::call_guard<py::gil_scoped_release>(),
+             "One InspectorResult per module/definition name or glob; instances=False reports "
+             "definitions only, without walking the hierarchy")
+        .def(
+            "inspect",
+            [](Design& design, const std::string& name) {
+                py::gil_scoped_release release;
+                return std::move(design.query({name}, true)[0]);
+            },
+            py::arg("name"), "The InspectorResult of a single module/definition name or glob")
+        .def("reload", &Design::reload, py::call_guard<py::gil_scoped_release>(),
+             "Re-elaborates the design unconditionally");
+}
@@ -0,0 +1,1996 @@
+// Inspector core: module/definition queries over a slang design. See Inspector.h.
+#include "Inspector.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "slang/ast/EvalContext.h"
+#include "slang/ast/Expression.h"
+#include "slang/ast/expressions/AssertionExpr.h"
+#include "slang/ast/expressions/MiscExpressions.h"
+#include "slang/ast/expressions/SelectExpressions.h"
+#include "slang/ast/symbols/CompilationUnitSymbols.h"
+#include "slang/ast/symbols/InstanceSymbols.h"
+#include "slang/ast/symbols/PortSymbols.h"
+#include "slang/ast/symbols/ValueSymbol.h"
+#include "slang/ast/types/Type.h"
+#include "slang/syntax/SyntaxVisitor.h"
+
+using namespace slang;
+using namespace slang::driver;
+using namespace slang::ast;
+using namespace slang::syntax;
+using json = nlohmann::json;
+
+std::string directionToString(ArgumentDirection dir) {
+    switch (dir) {
+        case ArgumentDirection::In:
+            return "Input";
+        case ArgumentDirection::Out:
+            return "Output";
+        case ArgumentDirection::InOut:
+            return "Inout";
+        case ArgumentDirection::Ref:
+            return "Ref";
+        default:
+            return "Unknown";
+    }
+}
+
+// ==========================================
+// Run Statistics (--stats)
+// ==========================================
+
+uint64_t peakRssBytes() {
+    rusage usage{};
+    ::getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss); // already bytes
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+double processCpuSeconds() {
+    rusage usage{};
+    ::getrusage(RUSAGE_SELF, &usage);
+    auto seconds = [](const timeval& tv) { return double(tv.tv_sec) + double(tv.tv_usec) / 1e6; };
+    return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+}
+
+void RunStats::add(std::string_view name, double wallSeconds, double cpuSeconds) {
+    for (auto& phase : phases) {
+        if (phase.name == name) {
+            phase.wallSeconds += wallSeconds;
+            phase.cpuSeconds += cpuSeconds;
+            return;
+        }
+    }
+    phases.push_back({std::string(name), wallSeconds, cpuSeconds});
+}
+
+uint64_t& RunStats::counter(std::string_view name) {
+    auto it = counters.find(name);
+    if (it == counters.end())
+        it = counters.emplace(std::string(name), 0).first;
+    return it->second;
+}
+
+void RunStats::countDiagnostics(const Diagnostics& diags) {
+    count("diagnostics", diags.size());
+    for (const auto& diag : diags) {
+        if (diag.isError())
+            count("diagnosticErrors", 1);
+    }
+}
+
+json RunStats::toJson() const {
+    json j = json::object();
+    j["phases"] = json::array();
+    for (const auto& phase : phases) {
+        j["phases"].push_back(
+            {{"name", phase.name}, {"wall", phase.wallSeconds}, {"cpu", phase.cpuSeconds}});
+    }
+    j["counters"] = json::object();
+    for (const auto& [name, value] : counters)
+        j["counters"][name] = value;
+    j["peakRssBytes"] = peakRssBytes();
+    return j;
+}
+
+void countResults(RunStats& stats, const std::vector<InspectorResult>& results) {
+    for (const auto& result : results) {
+        if (result.definition)
+            stats.count("definitionsReported", 1);
+        stats.count("instancesReported", result.instances.size());
+        for (const auto& info : result.instances)
+            stats.count("connectionsReported", info.connections.size());
+    }
+}
+
+void countCompilationDiagnostics(RunStats& stats, Compilation& compilation) {
+    RunStats::Phase phase(&stats, "diagnostics");
+    stats.countDiagnostics(compilation.getAllDiagnostics());
+}
+
+// ==========================================
+// Query Set: many names/globs, one traversal
+// ==========================================
+
+namespace {
+
+// Glob match supporting '*' (any run of characters) and '?' (any single character).
+bool globMatch(std::string_view pattern, std::string_view name) {
+    size_t p = 0, n = 0;
+    size_t starP = std::string_view::npos, starN = 0;
+    while (n < name.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+            p++;
+            n++;
+        }
+        else if (p < pattern.size() && pattern[p] == '*') {
+            starP = p++;
+            starN = n;
+        }
+        else if (starP != std::string_view::npos) {
+            p = starP + 1;
+            n = ++starN;
+        }
+        else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+        p++;
+    return p == pattern.size();
+}
+
+// The set of module/definition names being asked about. Exact names are looked up in a hash
+// table; glob patterns are only evaluated once per distinct definition name seen, so the cost of
+// a traversal does not grow with the number of queries.
+class QuerySet {
+public:
+    explicit QuerySet(std::vector<std::string> names) : names(std::move(names)) {
+        for (size_t i = 0; i < this->names.size(); i++) {
+            const std::string& q = this->names[i];
+            if (q.find_first_of("*?") != std::string::npos)
+                globs.push_back(i);
+            else
+                exact[q].push_back(i);
+        }
+    }
+
+    const std::vector<std::string>& queries() const { return names; }
+
+    // Indices of all queries matching a definition name. The string_view must outlive the set
+    // (definition names are owned by the Compilation).
+    const std::vector<size_t>& match(std::string_view name) {
+        auto cached = matchCache.find(name);
+        if (cached != matchCache.end())
+            return cached->second;
+        return matchCache.emplace(name, resolve(name)).first->second;
+    }
+
+    // Uncached form of match(); safe to call from several threads at once.
+    std::vector<size_t> resolve(std::string_view name) const {
+        std::vector<size_t> matches;
+        auto it = exact.find(name);
+        if (it != exact.end())
+            matches = it->second;
+        for (size_t i : globs) {
+            if (globMatch(names[i], name))
+                matches.push_back(i);
+        }
+        return matches;
+    }
+
+private:
+    std::vector<std::string> names;
+    std::unordered_map<std::string_view, std::vector<size_t>> exact;
+    std::vector<size_t> globs;
+    std::unordered_map<std::string_view, std::vector<size_t>> matchCache;
+};
+
+} // namespace
+
+// ==========================================
+// Field Projection (--fields)
+// ==========================================
+
+std::optional<FieldSet> FieldSet::parse(std::string_view list) {
+    static const std::unordered_map<std::string_view, Field> names = {
+        {"name", Field::Name},       {"path", Field::Path},     {"definition", Field::Definition},
+        {"offsets", Field::Offsets}, {"signal", Field::Signal}, {"width", Field::Width},
+        {"direction", Field::Direction}};
+
+    FieldSet set(0);
+    while (!list.empty()) {
+        auto comma = list.find(',');
+        auto it = names.find(list.substr(0, comma));
+        if (it == names.end())
+            return std::nullopt;
+        set.mask |= uint32_t(it->second);
+        list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+    }
+    return set;
+}
+
+// ==========================================
+// Liberty Pin Database (--liberty)
+// ==========================================
+
+std::optional<MappedFile> MappedFile::open(const std::filesystem::path& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return std::nullopt;
+
+    std::optional<MappedFile> file;
+    struct stat st;
+    if (::fstat(fd, &st) == 0) {
+        file.emplace();
+        if (st.st_size > 0) {
+            void* addr = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED)
+                file.reset();
+            else
+                file->bytes = {static_cast<const char*>(addr), size_t(st.st_size)};
+        }
+    }
+    ::close(fd);
+    return file;
+}
+
+MappedFile::~MappedFile() {
+    if (!bytes.empty())
+        ::munmap(const_cast<char*>(bytes.data()), bytes.size());
+}
+
+std::string_view libertyDirectionName(LibertyDirection direction) {
+    switch (direction) {
+        case LibertyDirection::Input:
+            return "Input";
+        case LibertyDirection::Output:
+            return "Output";
+        case LibertyDirection::Inout:
+            return "Inout";
+        default:
+            return "Unknown";
+    }
+}
+
+namespace {
+
+struct LibertyPin {
+    std::string name;
+    LibertyDirection direction = LibertyDirection::Unknown;
+    uint32_t width = 1;        // bit count; 0 if the bus type is not defined
+    std::string_view busType;  // bus groups only, resolved once the library is parsed
+    bool internal = false;
+};
+
+struct LibertyCell {
+    std::string name;
+    std::vector<LibertyPin> pins;
+};
+
+// Extracts cells with their pin/bus/pg_pin names, directions and bus widths from Liberty
+// source. Everything else (timing, power, tables) is skipped at the token level without being
+// stored, so memory stays proportional to the number of pins.
+class LibertyParser {
+public:
+    explicit LibertyParser(std::string_view text) : text(text) {}
+
+    // Appends the cells of every library group in the file. Returns false with `error` set
+    // (including the line number) on malformed input.
+    bool parse(std::vector<LibertyCell>& cells, std::string& error) {
+        try {
+            parseBody(true, ignoreAttribute, [&](std::string_view name, const Arguments&) {
+                if (name == "library")
+                    parseLibrary(cells);
+                else
+                    skipBody();
+            });
+            return true;
+        }
+        catch (const std::runtime_error& e) {
+            error = e.what();
+            return false;
+        }
+    }
+
+private:
+    enum class TokenKind { Word, String, Punct, End };
+    struct Token {
+        TokenKind kind;
+        std::string_view text;
+        size_t offset;
+    };
+    using Arguments = std::vector<std::string_view>;
+    using BusWidths = std::unordered_map<std::string_view, uint32_t>;
+
+    std::string_view text;
+    size_t pos = 0;
+    std::optional<Token> peeked;
+
+    static void ignoreAttribute(std::string_view, std::string_view) {}
+
+    [[noreturn]] void fail(size_t offset, const std::string& message) const {
+        auto line = std::count(text.begin(), text.begin() + std::min(offset, text.size()), '\n');
+        throw std::runtime_error("line " + std::to_string(line + 1) + ": " + message);
+    }
+
+    static bool isPunct(char c) {
+        return c == '(' || c == ')' || c == '{' || c == '}' || c == ':' || c == ';' || c == ',';
+    }
+    static bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+    }
+    static bool is(const Token& token, char c) {
+        return token.kind == TokenKind::Punct && token.text[0] == c;
+    }
+
+    bool startsComment(size_t at) const {
+        return at + 1 < text.size() && text[at] == '/' &&
+               (text[at + 1] == '*' || text[at + 1] == '/');
+    }
+
+    void skipTrivia() {
+        while (pos < text.size()) {
+            char c = text[pos];
+            if (isSpace(c) || c == '\\') { // '\' continues a line
+                pos++;
+            }
+            else if (startsComment(pos) && text[pos + 1] == '*') {
+                auto end = text.find("*/", pos + 2);
+                if (end == std::string_view::npos)
+                    fail(pos, "unterminated comment");
+                pos = end + 2;
+            }
+            else if (startsComment(pos)) {
+                auto end = text.find('\n', pos);
+                pos = end == std::string_view::npos ? text.size() : end;
+            }
+            else {
+                break;
+            }
+        }
+    }
+
+    Token lex() {
+        skipTrivia();
+        size_t start = pos;
+        if (pos >= text.size())
+            return {TokenKind::End, {}, start};
+
+        char c = text[pos];
+        if (isPunct(c)) {
+            pos++;
+            return {TokenKind::Punct, text.substr(start, 1), start};
+        }
+        if (c == '"') {
+            for (pos++; pos < text.size() && text[pos] != '"'; pos++) {
+                if (text[pos] == '\\')
+                    pos++;
+            }
+            if (pos >= text.size())
+                fail(start, "unterminated string");
+            pos++;
+            return {TokenKind::String, text.substr(start + 1, pos - start - 2), start};
+        }
+
+        // A bare word; bit ranges such as Q[7:0] keep their ':'.
+        bool inBrackets = false;
+        for (; pos < text.size(); pos++) {
+            c = text[pos];
+            if (c == '[')
+                inBrackets = true;
+            else if (c == ']')
+                inBrackets = false;
+            else if (!inBrackets && (isSpace(c) || isPunct(c) || c == '"' || startsComment(pos)))
+                break;
+        }
+        return {TokenKind::Word, text.substr(start, pos - start), start};
+    }
+
+    Token next() {
+        if (peeked)
+            return *std::exchange(peeked, std::nullopt);
+        return lex();
+    }
+
+    const Token& peek() {
+        if (!peeked)
+            peeked = lex();
+        return *peeked;
+    }
+
+    Arguments parseArguments() {
+        Arguments args;
+        while (true) {
+            Token token = next();
+            if (token.kind == TokenKind::End)
+                fail(token.offset, "unexpected end of file in argument list");
+            if (is(token, ')'))
+                return args;
+            if (token.kind == TokenKind::Word || token.kind == TokenKind::String)
+                args.push_back(token.text);
+        }
+    }
+
+    // Parses statements up to the closing brace of the current group, or to the end of the file
+    // at top level. Simple attributes (`name : value;`) go to onAttribute; groups
+    // (`name (args) { ... }`) go to onGroup, which must consume the body with parseBody or
+    // skipBody. Complex attributes (`name (args);`) are ignored.
+    template<typename OnAttribute, typename OnGroup>
+    void parseBody(bool topLevel, OnAttribute&& onAttribute, OnGroup&& onGroup) {
+        while (true) {
+            Token token = next();
+            if (token.kind == TokenKind::End) {
+                if (!topLevel)
+                    fail(token.offset, "unexpected end of file, missing '}'");
+                return;
+            }
+            if (is(token, '}')) {
+                if (topLevel)
+                    fail(token.offset, "unbalanced '}'");
+                return;
+            }
+            if (token.kind != TokenKind::Word)
+                continue;
+
+            if (is(peek(), ':')) {
+                next();
+                Token value = next();
+                if (value.kind != TokenKind::Word && value.kind != TokenKind::String)
+                    fail(value.offset, "expected a value for '" + std::string(token.text) + "'");
+                if (is(peek(), ';'))
+                    next();
+                onAttribute(token.text, value.text);
+            }
+            else if (is(peek(), '(')) {
+                next();
+                Arguments args = parseArguments();
+                if (is(peek(), '{')) {
+                    next();
+                    onGroup(token.text, args);
+                }
+                else if (is(peek(), ';')) {
+                    next();
+                }
+            }
+        }
+    }
+
+    void skipBody() {
+        for (int depth = 1; depth > 0;) {
+            Token token = next();
+            if (token.kind == TokenKind::End)
+                fail(token.offset, "unexpected end of file, missing '}'");
+            if (is(token, '{'))
+                depth++;
+            else if (is(token, '}'))
+                depth--;
+        }
+    }
+
+    // type (name) { bit_width : 8; bit_from : 7; bit_to : 0; ... }
+    uint32_t parseBusType() {
+        std::optional<int64_t> width, from, to;
+        parseBody(
+            false,
+            [&](std::string_view name, std::string_view value) {
+                int64_t number = std::strtoll(std::string(value).c_str(), nullptr, 10);
+                if (name == "bit_width")
+                    width = number;
+                else if (name == "bit_from")
+                    from = number;
+                else if (name == "bit_to")
+                    to = number;
+            },
+            [&](std::string_view, const Arguments&) { skipBody(); });
+
+        if (!width && from && to)
+            width = std::abs(*from - *to) + 1;
+        return width && *width > 0 ? uint32_t(*width) : 0;
+    }
+
+    // pin (A, B) / pg_pin (VDD) / bus (Q): direction and, for buses, the bus type. Nested groups,
+    // including the per-bit pins of a bus, are skipped.
+    void parsePins(std::vector<LibertyPin>& pins, size_t first) {
+        parseBody(
+            false,
+            [&](std::string_view name, std::string_view value) {
+                for (size_t i = first; i < pins.size(); i++) {
+                    if (name == "direction") {
+                        pins[i].internal = value == "internal";
+                        pins[i].direction = value == "input"    ? LibertyDirection::Input
+                                            : value == "output" ? LibertyDirection::Output
+                                            : value == "inout"  ? LibertyDirection::Inout
+                                                                : LibertyDirection::Unknown;
+                    }
+                    else if (name == "bus_type") {
+                        pins[i].busType = value;
+                    }
+                }
+            },
+            [&](std::string_view, const Arguments&) { skipBody(); });
+    }
+
+    void parseCell(std::string_view name, LibertyCell& cell, BusWidths& busWidths) {
+        cell.name = std::string(name);
+        parseBody(false, ignoreAttribute, [&](std::string_view group, const Arguments& args) {
+            if (group == "pin" || group == "pg_pin" || group == "bus") {
+                size_t first = cell.pins.size();
+                for (auto arg : args) {
+                    auto& pin = cell.pins.emplace_back();
+                    pin.name = std::string(arg);
+                    pin.width = group == "bus" ? 0 : 1; // buses take their bus_type's width
+                }
+                parsePins(cell.pins, first);
+            }
+            else if (group == "type" && !args.empty()) {
+                busWidths[args[0]] = parseBusType();
+            }
+            else {
+                skipBody();
+            }
+        });
+    }
+
+    void parseLibrary(std::vector<LibertyCell>& cells) {
+        BusWidths libraryWidths;
+        std::vector<BusWidths> cellWidths;
+        size_t first = cells.size();
+        parseBody(false, ignoreAttribute, [&](std::string_view group, const Arguments& args) {
+            if (group == "cell" && !args.empty()) {
+                parseCell(args[0], cells.emplace_back(), cellWidths.emplace_back());
+            }
+            else if (group == "type" && !args.empty()) {
+                libraryWidths[args[0]] = parseBusType();
+            }
+            else {
+                skipBody();
+            }
+        });
+
+        // Bus types may be declared in the cell or anywhere in the library.
+        for (size_t c = first; c < cells.size(); c++) {
+            auto& pins = cells[c].pins;
+            for (auto& pin : pins) {
+                if (pin.busType.empty())
+                    continue;
+                const auto& local = cellWidths[c - first];
+                if (auto it = local.find(pin.busType); it != local.end())
+                    pin.width = it->second;
+                else if (auto it = libraryWidths.find(pin.busType); it != libraryWidths.end())
+                    pin.width = it->second;
+            }
+            std::erase_if(pins, [](const LibertyPin& pin) { return pin.internal; });
+        }
+    }
+};
+
+// Serializes cells, keeping the first definition of a cell or pin name.
+std::string buildLibertyIndex(std::vector<LibertyCell> cells, uint64_t sourceSize,
+                              int64_t sourceMtime) {
+    auto byName = [](const auto& a, const auto& b) { return a.name < b.name; };
+    auto sameName = [](const auto& a, const auto& b) { return a.name == b.name; };
+    std::stable_sort(cells.begin(), cells.end(), byName);
+    cells.erase(std::unique(cells.begin(), cells.end(), sameName), cells.end());
+
+    std::vector<LibertyCellRecord> cellRecords;
+    std::vector<LibertyPinRecord> pinRecords;
+    std::string names;
+    auto addName = [&](const std::string& name, uint32_t& offset, uint32_t& length) {
+        offset = uint32_t(names.size());
+        length = uint32_t(name.size());
+        names += name;
+    };
+    for (auto& cell : cells) {
+        std::stable_sort(cell.pins.begin(), cell.pins.end(), byName);
+        cell.pins.erase(std::unique(cell.pins.begin(), cell.pins.end(), sameName),
+                        cell.pins.end());
+
+        auto& record = cellRecords.emplace_back();
+        addName(cell.name, record.nameOffset, record.nameLength);
+        record.firstPin = uint32_t(pinRecords.size());
+        record.pinCount = uint32_t(cell.pins.size());
+        for (const auto& pin : cell.pins) {
+            LibertyPinRecord pinRecord{};
+            addName(pin.name, pinRecord.nameOffset, pinRecord.nameLength);
+            pinRecord.width = pin.width;
+            pinRecord.direction = uint8_t(pin.direction);
+            pinRecords.push_back(pinRecord);
+        }
+    }
+    if (names.size() > UINT32_MAX || pinRecords.size() > UINT32_MAX)
+        throw std::runtime_error("library too large to index");
+
+    LibertyIndexHeader header{};
+    std::memcpy(header.magic, LibertyIndex::Magic, sizeof(LibertyIndex::Magic));
+    header.version = LibertyIndex::FormatVersion;
+    header.cellCount = uint32_t(cellRecords.size());
+    header.pinCount = uint32_t(pinRecords.size());
+    header.sourceSize = sourceSize;
+    header.sourceMtime = sourceMtime;
+    header.nameBytes = names.size();
+
+    std::string bytes;
+    bytes.reserve(sizeof(header) + cellRecords.size() * sizeof(LibertyCellRecord) +
+                  pinRecords.size() * sizeof(LibertyPinRecord) + names.size());
+    auto append = [&](const void* data, size_t size) {
+        bytes.append(static_cast<const char*>(data), size);
+    };
+    append(&header, sizeof(header));
+    append(cellRecords.data(), cellRecords.size() * sizeof(LibertyCellRecord));
+    append(pinRecords.data(), pinRecords.size() * sizeof(LibertyPinRecord));
+    append(names.data(), names.size());
+    return bytes;
+}
+
+std::filesystem::path libertyIndexPath(const std::string& path,
+                                       const std::optional<std::string>& indexDir) {
+    if (!indexDir)
+        return path + ".pinidx";
+
+    std::error_code ec;
+    auto absolute = std::filesystem::absolute(path, ec).string();
+    char name[40];
+    std::snprintf(name, sizeof(name), "liberty-%016zx.pinidx",
+                  std::hash<std::string>{}(absolute));
+    return std::filesystem::path(*indexDir) / name;
+}
+
+// Write-then-rename so concurrent runs never map a partial index.
+void writeLibertyIndex(const std::filesystem::path& path, std::string_view bytes) {
+    std::error_code ec;
+    if (path.has_parent_path())
+        std::filesystem::create_directories(path.parent_path(), ec);
+    auto tmpPath = path;
+    tmpPath += ".tmp" + std::to_string(::getpid());
+    {
+        std::ofstream out(tmpPath, std::ios::binary);
+        out.write(bytes.data(), std::streamsize(bytes.size()));
+        if (!out) {
+            out.close();
+            std::filesystem::remove(tmpPath, ec);
+            return;
+        }
+    }
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec)
+        std::filesystem::remove(tmpPath, ec);
+}
+
+} // namespace
+
+std::string defaultCacheDir() {
+    std::filesystem::path base;
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+        base = xdg;
+    else if (const char* home = std::getenv("HOME"); home && *home)
+        base = std::filesystem::path(home) / ".cache";
+    else {
+        std::error_code ec;
+        base = std::filesystem::temp_directory_path(ec);
+    }
+    return (base / "slang-inspector").string();
+}
+
+std::optional<LibertyIndex> LibertyIndex::open(std::string_view bytes, uint64_t sourceSize,
+                                               int64_t sourceMtime) {
+    if (bytes.size() < sizeof(LibertyIndexHeader))
+        return std::nullopt;
+    LibertyIndexHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 ||
+        header.version != FormatVersion || header.sourceSize != sourceSize ||
+        header.sourceMtime != sourceMtime) {
+        return std::nullopt;
+    }
+    uint64_t expected = sizeof(header) +
+                        uint64_t(header.cellCount) * sizeof(LibertyCellRecord) +
+                        uint64_t(header.pinCount) * sizeof(LibertyPinRecord) + header.nameBytes;
+    if (expected != bytes.size())
+        return std::nullopt;
+
+    LibertyIndex index;
+    auto cells = bytes.data() + sizeof(header);
+    auto pins = cells + header.cellCount * sizeof(LibertyCellRecord);
+    index.cells = {reinterpret_cast<const LibertyCellRecord*>(cells), header.cellCount};
+    index.pins = {reinterpret_cast<const LibertyPinRecord*>(pins), header.pinCount};
+    index.names = bytes.substr(bytes.size() - header.nameBytes);
+    return index;
+}
+
+const LibertyCellRecord* LibertyIndex::findCell(std::string_view name) const {
+    auto it = std::lower_bound(cells.begin(), cells.end(), name,
+                               [&](const LibertyCellRecord& cell, std::string_view key) {
+                                   return this->name(cell) < key;
+                               });
+    return it != cells.end() && this->name(*it) == name ? &*it : nullptr;
+}
+
+std::optional<LibertyPinInfo> LibertyIndex::findPin(const LibertyCellRecord& cell,
+                                                   std::string_view name) const {
+    if (uint64_t(cell.firstPin) + cell.pinCount > pins.size())
+        return std::nullopt;
+    auto cellPins = pins.subspan(cell.firstPin, cell.pinCount);
+    auto it = std::lower_bound(cellPins.begin(), cellPins.end(), name,
+                               [&](const LibertyPinRecord& pin, std::string_view key) {
+                                   return this->name(pin) < key;
+                               });
+    if (it == cellPins.end() || this->name(*it) != name)
+        return std::nullopt;
+    return LibertyPinInfo{libertyDirectionName(LibertyDirection(it->direction)), it->width};
+}
+
+bool LibertyDatabase::load(const std::vector<std::string>& paths,
+                           const std::optional<std::string>& indexDir, std::string& error) {
+    for (const auto& path : paths) {
+        std::error_code ec;
+        uint64_t size = std::filesystem::file_size(path, ec);
+        auto modified = std::filesystem::last_write_time(path, ec);
+        int64_t mtime = modified.time_since_epoch().count();
+        if (ec) {
+            error = "cannot read Liberty file '" + path + "'";
+            return false;
+        }
+
+        auto indexPath = libertyIndexPath(path, indexDir);
+        if (auto mapped = MappedFile::open(indexPath)) {
+            if (auto index = LibertyIndex::open(mapped->data(), size, mtime)) {
+                mappings.push_back(std::move(*mapped));
+                indexes.push_back(*index);
+                continue;
+            }
+        }
+
+        auto source = MappedFile::open(path);
+        std::vector<LibertyCell> cells;
+        std::string parseError;
+        if (!source) {
+            error = "cannot read Liberty file '" + path + "'";
+            return false;
+        }
+        if (!LibertyParser(source->data()).parse(cells, parseError)) {
+            error = path + ": " + parseError;
+            return false;
+        }
+
+        try {
+            auto& bytes = *built.emplace_back(std::make_unique<std::string>(
+                buildLibertyIndex(std::move(cells), size, mtime)));
+            indexes.push_back(*LibertyIndex::open(bytes, size, mtime));
+            writeLibertyIndex(indexPath, bytes);
+            rebuilt++;
+        }
+        catch (const std::runtime_error& e) {
+            error = path + ": " + e.what();
+            return false;
+        }
+    }
+    return true;
+}
+
+LibertyDatabase::Cell LibertyDatabase::findCell(std::string_view name) const {
+    for (const auto& index : indexes) {
+        if (auto record = index.findCell(name))
+            return Cell(&index, record);
+    }
+    return {};
+}
+
+size_t LibertyDatabase::cellCount() const {
+    size_t count = 0;
+    for (const auto& index : indexes)
+        count += index.cellCount();
+    return count;
+}
+
+// ==========================================
+// Connection Info Builder
+// ==========================================
+
+namespace {
+
+// Port name -> direction for a definition found by collectDefinitions, used to resolve
+// directions of blackbox connections with one hash lookup each.
+using PortDirectionTable = std::unordered_map<std::string_view, std::string_view>;
+
+// Definition name -> its port directions. Keyed by definition rather than by query, so a glob
+// matching several definitions never lends one module's directions to another's instances.
+using DirectionTables = std::unordered_map<std::string_view, PortDirectionTable>;
+
+const PortDirectionTable* findDirections(const DirectionTables& tables,
+                                         std::string_view definitionName) {
+    auto it = tables.find(definitionName);
+    return it != tables.end() ? &it->second : nullptr;
+}
+
+// Width of a connection taken from a --liberty pin, marked so it is never mistaken for a width
+// the compiler worked out. Shared by the elaborated and --syntax-only paths.
+std::string libertyWidth(uint32_t width) {
+    return std::to_string(width) + " (from liberty)";
+}
+
+// Builds InstanceInfo/ConnectionInfo for the requested fields only. Type names, widths and
+// expression text are formatted once per distinct Type, syntax node or Expression and reused:
+// instances of the same definition share their types and connection syntax. Not thread-safe;
+// use one builder per worker.
+class InfoBuilder {
+public:
+    explicit InfoBuilder(FieldSet fields = FieldSet::all(),
+                         const LibertyDatabase* liberty = nullptr) :
+        fields(fields), liberty(liberty) {}
+
+    bool has(Field field) const { return fields.has(field); }
+
+    const std::string& typeName(const Type& type) {
+        auto it = typeNames.find(&type);
+        if (it == typeNames.end())
+            it = typeNames.emplace(&type, type.toString()).first;
+        return it->second;
+    }
+
+    const std::string& bitWidth(const Type& type) {
+        auto it = typeWidths.find(&type);
+        if (it == typeWidths.end())
+            it = typeWidths.emplace(&type, std::to_string(type.getBitWidth())).first;
+        return it->second;
+    }
+
+    const std::string& syntaxText(const SyntaxNode& syntax) {
+        auto it = syntaxTexts.find(&syntax);
+        if (it == syntaxTexts.end())
+            it = syntaxTexts.emplace(&syntax, syntax.toString()).first;
+        return it->second;
+    }
+
+    // Width of a blackbox connection expression, inferring it from the expression when the type
+    // did not resolve.
+    const std::string& inferWidth(const Expression& expr, const Scope& scope) {
+        auto it = inferredWidths.find(&expr);
+        if (it == inferredWidths.end())
+            it = inferredWidths.emplace(&expr, computeInferredWidth(expr, scope)).first;
+        return it->second;
+    }
+
+    InstanceInfo instance(const InstanceSymbol& instance) {
+        InstanceInfo instInfo = header(instance, instance.getDefinition().name);
+
+        for (auto conn : instance.getPortConnections()) {
+            ConnectionInfo connInfo;
+            if (has(Field::Name))
+                connInfo.portName = std::string(conn->port.name);
+
+            if (has(Field::Direction)) {
+                connInfo.direction = "Unknown";
+                if (conn->port.kind == SymbolKind::Port)
+                    connInfo.direction = directionToString(conn->port.as<PortSymbol>().direction);
+                else if (conn->port.kind == SymbolKind::MultiPort)
+                    connInfo.direction =
+                        directionToString(conn->port.as<MultiPortSymbol>().direction);
+            }
+
+            const Expression* expr = conn->getExpression();
+            if (expr) {
+                const Type& type = *expr->type;
+                if (has(Field::Signal))
+                    connInfo.signalType = typeName(type);
+                if (has(Field::Width))
+                    connInfo.width = bitWidth(type);
+                connInfo.isConnected = true;
+            }
+            else {
+                if (has(Field::Signal))
+                    connInfo.signalType = "Unknown";
+                if (has(Field::Width))
+                    connInfo.width = "0"; // Or unknown
+                connInfo.isConnected = false;
+            }
+            instInfo.connections.push_back(std::move(connInfo));
+        }
+        return instInfo;
+    }
+
+    InstanceInfo instance(const UninstantiatedDefSymbol& uninst, const DirectionTables& tables) {
+        InstanceInfo instInfo = header(uninst, uninst.definitionName);
+        const PortDirectionTable* directions = findDirections(tables, uninst.definitionName);
+
+        const Scope& scope = *uninst.getParentScope();
+        auto portNames = uninst.getPortNames();
+        auto portExprs = uninst.getPortConnections();
+
+        // Library cells have no definition in the sources; their pins come from --liberty.
+        LibertyDatabase::Cell cell;
+        if (liberty && (has(Field::Direction) || has(Field::Width)))
+            cell = liberty->findCell(uninst.definitionName);
+
+        for (size_t i = 0; i < portExprs.size(); i++) {
+            ConnectionInfo connInfo;
+            // The port name is needed to look up the direction even if it is not reported.
+            std::string portName = i < portNames.size() && !portNames[i].empty()
+                                       ? std::string(portNames[i])
+                                       : "[Positional #" + std::to_string(i) + "]";
+            auto pin = cell.pin(portName);
+
+            if (portExprs[i] && portExprs[i]->kind == AssertionExprKind::Simple) {
+                const auto& simpleExpr = portExprs[i]->as<SimpleAssertionExpr>();
+                const Expression& expr = simpleExpr.expr;
+                if (has(Field::Signal))
+                    connInfo.signalType = typeName(*expr.type);
+                if (has(Field::Width)) {
+                    // The cell's pin width beats guessing from an unresolved expression.
+                    if (pin && pin->width && expr.type->isError())
+                        connInfo.width = libertyWidth(pin->width);
+                    else
+                        connInfo.width = inferWidth(expr, scope);
+                }
+                connInfo.isConnected = true;
+            }
+            else if (portExprs[i]) {
+                // Some other connection type, considered connected but maybe complex
+                if (has(Field::Signal))
+                    connInfo.signalType = "Complex/Unresolved"; // Simplified for now
+                if (has(Field::Width))
+                    connInfo.width = pin && pin->width ? libertyWidth(pin->width) : "0";
+                connInfo.isConnected = true;
+            }
+            else {
+                if (has(Field::Signal))
+                    connInfo.signalType = "Unconnected";
+                if (has(Field::Width))
+                    connInfo.width = "0";
+                connInfo.isConnected = false;
+            }
+
+            if (has(Field::Direction)) {
+                connInfo.direction = "Unknown";
+                // Try to look up direction from definition if available
+                if (directions) {
+                    auto it = directions->find(portName);
+                    if (it != directions->end())
+                        connInfo.direction = std::string(it->second);
+                }
+                if (connInfo.direction == "Unknown" && pin)
+                    connInfo.direction = std::string(pin->direction);
+            }
+
+            if (has(Field::Name))
+                connInfo.portName = std::move(portName);
+            instInfo.connections.push_back(std::move(connInfo));
+        }
+        return instInfo;
+    }
+
+    InstanceInfo instance(const Symbol& symbol, const DirectionTables& tables) {
+        if (symbol.kind == SymbolKind::Instance)
+            return instance(symbol.as<InstanceSymbol>());
+        return instance(symbol.as<UninstantiatedDefSymbol>(), tables);
+    }
+
+    // Name, path, definition and source range of an instance-like symbol.
+    InstanceInfo header(const Symbol& symbol, std::string_view definitionName) {
+        InstanceInfo instInfo;
+        if (has(Field::Name))
+            instInfo.instanceName = std::string(symbol.name);
+        if (has(Field::Path))
+            instInfo.fullPath = symbol.getHierarchicalPath();
+        if (has(Field::Definition))
+            instInfo.definitionName = std::string(definitionName);
+        if (has(Field::Offsets)) {
+            if (const SyntaxNode* syntax = symbol.getSyntax()) {
+                SourceRange range = syntax->sourceRange();
+                instInfo.startOffset = range.start().offset();
+                instInfo.endOffset = range.end().offset();
+            }
+        }
+        return instInfo;
+    }
+
+private:
+    FieldSet fields;
+    const LibertyDatabase* liberty;
+    std::unordered_map<const Type*, std::string> typeNames;
+    std::unordered_map<const Type*, std::string> typeWidths;
+    std::unordered_map<const SyntaxNode*, std::string> syntaxTexts;
+    std::unordered_map<const Expression*, std::string> inferredWidths;
+    std::unique_ptr<EvalContext> evalCtx; // shared by all slice bound evaluations
+
+    EvalContext& evalContext(const Scope& scope) {
+        if (!evalCtx)
+            evalCtx = std::make_unique<EvalContext>(scope.getCompilation().getRoot());
+        return *evalCtx;
+    }
+
+    std::string computeInferredWidth(const Expression& expr, const Scope& scope) {
+        const Type& type = *expr.type;
+        auto width = type.getBitWidth();
+
+        if (width > 0 || !type.isError())
+            return std::to_string(width);
+
+        // For error types, try to infer from expression kind
+        const Expression* targetExpr = &expr;
+
+        // If this is an InvalidExpression, try to unwrap it
+        if (expr.kind == ExpressionKind::Invalid) {
+            const auto& invalidExpr = expr.as<InvalidExpression>();
+            if (invalidExpr.child) {
+                targetExpr = invalidExpr.child;
+            }
+        }
+
+        // Check if this is a RangeSelect expression (e.g., dat_i[63:0])
+        if (targetExpr->kind == ExpressionKind::RangeSelect) {
+            const auto& rangeExpr = targetExpr->as<RangeSelectExpression>();
+
+            // Try to get width from the type first
+            auto rangeWidth = rangeExpr.type->getBitWidth();
+            if (rangeWidth > 0) {
+                return std::to_string(rangeWidth) + " (inferred from slice)";
+            }
+
+            // Try to calculate width from left and right bounds
+            EvalContext& ctx = evalContext(scope);
+            auto leftVal = rangeExpr.left().eval(ctx);
+            auto rightVal = rangeExpr.right().eval(ctx);
+
+            if (leftVal.isInteger() && rightVal.isInteger()) {
+                int64_t left = leftVal.integer().as<int64_t>().value_or(0);
+                int64_t right = rightVal.integer().as<int64_t>().value_or(0);
+                int64_t calculatedWidth = std::abs(left - right) + 1;
+                return std::to_string(calculatedWidth) + " (calculated from [" +
+                       std::to_string(left) + ":" + std::to_string(right) + "])";
+            }
+            return "(unable to evaluate slice bounds)";
+        }
+
+        // Check if this is a NamedValue expression (e.g., addr_i)
+        if (targetExpr->kind == ExpressionKind::NamedValue) {
+            const auto& namedExpr = targetExpr->as<NamedValueExpression>();
+            const ValueSymbol& symbol = namedExpr.symbol;
+            const auto& type = symbol.getType();
+            auto width = type.getBitWidth();
+
+            if (width > 0) {
+                return std::to_string(width) + " (inferred from symbol '" +
+                       std::string(symbol.name) + "')";
+            }
+            else {
+                return "(NamedValue symbol '" + std::string(symbol.name) +
+                       "' type: " + typeName(type) + ")";
+            }
+        }
+
+        return "(type error, expression kind: " + std::string(toString(targetExpr->kind)) + ")";
+    }
+};
+
+// ==========================================
+// Definition -> Instances Index
+// ==========================================
+
+// Built in a single pass over the elaborated hierarchy. Instance symbols are recorded in
+// traversal order and grouped by definition name; duplicates are rejected by symbol identity, so
+// no hierarchical path strings are built while walking.
+class InstanceIndex {
+public:
+    void build(const Scope& scope) {
+        for (auto& member : scope.members()) {
+            visitedSymbols++;
+            if (member.kind == SymbolKind::Instance) {
+                const auto& instance = member.as<InstanceSymbol>();
+                if (add(instance.getDefinition().name, instance))
+                    build(instance.body);
+            }
+            else if (member.kind == SymbolKind::UninstantiatedDef) {
+                add(member.as<UninstantiatedDefSymbol>().definitionName, member);
+            }
+            else if (member.isScope()) {
+                build(member.as<Scope>());
+            }
+        }
+    }
+
+    // Records a single instance without descending into it. Returns false if already seen.
+    bool record(const Symbol& symbol) {
+        visitedSymbols++;
+        std::string_view defName = symbol.kind == SymbolKind::Instance
+                                       ? symbol.as<InstanceSymbol>().getDefinition().name
+                                       : symbol.as<UninstantiatedDefSymbol>().definitionName;
+        return add(defName, symbol);
+    }
+
+    const std::vector<const Symbol*>& instances() const { return symbols; }
+
+    // Number of symbols looked at while building, for --stats.
+    size_t symbolsVisited() const { return visitedSymbols; }
+
+    // Definition name -> positions in instances(), ascending.
+    const std::unordered_map<std::string_view, std::vector<uint32_t>>& definitions() const {
+        return byDefinition;
+    }
+
+private:
+    std::vector<const Symbol*> symbols;
+    std::unordered_map<std::string_view, std::vector<uint32_t>> byDefinition;
+    std::unordered_set<const Symbol*> visited;
+    size_t visitedSymbols = 0;
+
+    bool add(std::string_view defName, const Symbol& symbol) {
+        if (!visited.insert(&symbol).second)
+            return false;
+        byDefinition[defName].push_back(static_cast<uint32_t>(symbols.size()));
+        symbols.push_back(&symbol);
+        return true;
+    }
+};
+
+// Direction tables of every definition in the results. The views point into `results`, which
+// must not be resized while the tables are in use.
+DirectionTables buildDirectionTables(const std::vector<InspectorResult>& results) {
+    DirectionTables tables;
+    for (const auto& result : results) {
+        if (!result.definition)
+            continue;
+        auto [it, added] = tables.try_emplace(result.definition->name);
+        if (!added)
+            continue;
+        for (const auto& p : result.definition->ports)
+            it->second.emplace(p.name, p.direction);
+    }
+    return tables;
+}
+
+// ==========================================
+// Collect Module Definition
+// ==========================================
+
+// Ports and direct child instances of one instance's body.
+DefinitionInfo describeDefinition(const InstanceSymbol& instance, InfoBuilder& builder) {
+    DefinitionInfo defInfo;
+    defInfo.name = std::string(instance.getDefinition().name);
+
+    const InstanceBodySymbol& body = instance.body;
+    for (auto& member : body.members()) {
+        if (member.kind == SymbolKind::Port) {
+            const auto& port = member.as<PortSymbol>();
+            PortInfo portInfo;
+            // Port names also key the blackbox direction lookup; runQueries drops them again
+            // when only directions were requested.
+            if (builder.has(Field::Name) || builder.has(Field::Direction))
+                portInfo.name = std::string(port.name);
+            if (builder.has(Field::Direction))
+                portInfo.direction = directionToString(port.direction);
+            if (builder.has(Field::Signal))
+                portInfo.type = builder.typeName(port.getType());
+            defInfo.ports.push_back(portInfo);
+        }
+        else if (member.kind == SymbolKind::UninstantiatedDef) {
+            const auto& uninst = member.as<UninstantiatedDefSymbol>();
+            InstanceInfo subInst = builder.header(uninst, uninst.definitionName);
+
+            auto portNames = uninst.getPortNames();
+            auto portExprs = uninst.getPortConnections();
+
+            for (size_t i = 0; i < portExprs.size(); i++) {
+                ConnectionInfo connInfo;
+                if (builder.has(Field::Name)) {
+                    connInfo.portName = i < portNames.size() && !portNames[i].empty()
+                                            ? std::string(portNames[i])
+                                            : "[Positional #" + std::to_string(i) + "]";
+                }
+
+                if (portExprs[i]) {
+                    const Expression* expr = nullptr;
+                    if (portExprs[i]->kind == AssertionExprKind::Simple) {
+                        expr = &portExprs[i]->as<SimpleAssertionExpr>().expr;
+                    }
+
+                    if (expr && builder.has(Field::Signal)) {
+                        connInfo.signalType = expr->syntax ? builder.syntaxText(*expr->syntax)
+                                                           : builder.typeName(*expr->type);
+                    }
+                    else if (builder.has(Field::Signal)) {
+                        connInfo.signalType =
+                            "Complex/Unresolved"; // Handle Sequence/Property exprs if needed
+                    }
+                    connInfo.isConnected = true;
+                }
+                else {
+                    connInfo.isConnected = false;
+                }
+                subInst.connections.push_back(connInfo);
+            }
+            defInfo.instances.push_back(subInst);
+        }
+        else if (member.kind == SymbolKind::Instance) {
+            const auto& inst = member.as<InstanceSymbol>();
+            InstanceInfo subInst = builder.header(inst, inst.getDefinition().name);
+
+            for (auto conn : inst.getPortConnections()) {
+                ConnectionInfo connInfo;
+                if (builder.has(Field::Name))
+                    connInfo.portName = std::string(conn->port.name);
+
+                const Expression* expr = conn->getExpression();
+                if (expr) {
+                    if (builder.has(Field::Signal)) {
+                        connInfo.signalType = expr->syntax ? builder.syntaxText(*expr->syntax)
+                                                           : builder.typeName(*expr->type);
+                    }
+                    connInfo.isConnected = true;
+                }
+                else {
+                    connInfo.isConnected = false;
+                }
+                subInst.connections.push_back(connInfo);
+            }
+            defInfo.instances.push_back(subInst);
+        }
+    }
+    return defInfo;
+}
+
+// Fills in the definition answering each query. Top instances (or the --scope instance) are
+// described from their own bodies. Other definitions come from the first instance of them met by
+// the walk, which is already elaborated, and failing that from a default instance of the entry in
+// the definition table: a definition deep in (or outside) the walked subtree costs one body
+// elaboration rather than the whole design's. A frozen compilation cannot create instances, so
+// there only elaborated instances answer. A glob matching several definitions is answered with
+// the first one found in that order.
+void collectDefinitions(Compilation& compilation, const InstanceSymbol* scope,
+                        std::span<const InstanceIndex> indexes, QuerySet& queries,
+                        std::vector<InspectorResult>& results, InfoBuilder& builder) {
+    auto describeMatches = [&](const InstanceSymbol& instance) {
+        const auto& matches = queries.match(instance.getDefinition().name);
+        if (matches.empty())
+            return;
+        DefinitionInfo defInfo = describeDefinition(instance, builder);
+        for (size_t q : matches) {
+            if (!results[q].definition)
+                results[q].definition = defInfo;
+        }
+    };
+    if (scope) {
+        describeMatches(*scope);
+    }
+    else {
+        for (auto instance : compilation.getRoot().topInstances)
+            describeMatches(*instance);
+    }
+
+    // Earliest instance of a matching definition, in traversal order.
+    for (const auto& index : indexes) {
+        std::vector<std::optional<uint32_t>> first(results.size());
+        for (const auto& [defName, positions] : index.definitions()) {
+            for (size_t q : queries.match(defName)) {
+                if (results[q].definition)
+                    continue;
+                for (uint32_t pos : positions) {
+                    if (index.instances()[pos]->kind == SymbolKind::Instance) {
+                        if (!first[q] || pos < *first[q])
+                            first[q] = pos;
+                        break;
+                    }
+                }
+            }
+        }
+        for (size_t q = 0; q < results.size(); q++) {
+            if (first[q]) {
+                const auto& instance = index.instances()[*first[q]]->as<InstanceSymbol>();
+                results[q].definition = describeDefinition(instance, builder);
+            }
+        }
+    }
+
+    if (compilation.isFrozen())
+        return;
+    for (auto definition : compilation.getDefinitions()) {
+        const auto& matches = queries.match(definition->name);
+        bool wanted = std::any_of(matches.begin(), matches.end(),
+                                  [&](size_t q) { return !results[q].definition; });
+        if (!wanted)
+            continue;
+        auto& instance = InstanceSymbol::createDefault(compilation, *definition);
+        DefinitionInfo defInfo = describeDefinition(instance, builder);
+        for (size_t q : matches) {
+            if (!results[q].definition)
+                results[q].definition = defInfo;
+        }
+    }
+}
+
+// ==========================================
+// Collect Instantiations
+// ==========================================
+
+// Positions in the index matching each query, in traversal order. Queries are resolved against
+// the distinct definition names only.
+std::vector<std::vector<uint32_t>> selectInstances(const InstanceIndex& index, QuerySet& queries) {
+    std::vector<std::vector<uint32_t>> selected(queries.queries().size());
+    for (const auto& [defName, positions] : index.definitions()) {
+        for (size_t q : queries.match(defName))
+            selected[q].insert(selected[q].end(), positions.begin(), positions.end());
+    }
+
+    // Globs may span several definitions; restore traversal order.
+    for (auto& positions : selected)
+        std::sort(positions.begin(), positions.end());
+    return selected;
+}
+
+void collectInstantiationsInAST(const InstanceIndex& index, QuerySet& queries,
+                                std::vector<InspectorResult>& results, ResultSink* sink,
+                                InfoBuilder& builder) {
+    auto selected = selectInstances(index, queries);
+    auto directions = buildDirectionTables(results);
+
+    for (size_t q = 0; q < results.size(); q++) {
+        for (uint32_t pos : selected[q]) {
+            InstanceInfo info = builder.instance(*index.instances()[pos], directions);
+            if (sink)
+                sink->instance(q, std::move(info));
+            else
+                results[q].instances.push_back(std::move(info));
+        }
+    }
+}
+
+// ==========================================
+// Parallel Collection (--threads N)
+// ==========================================
+
+// Number of workers parallelFor uses for `count` items.
+unsigned workerCount(size_t count, unsigned threads) {
+    return static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads, count)));
+}
+
+// Runs fn(i, worker) for every i in [0, count) on workerCount(count, threads) workers, where
+// worker identifies the calling worker (for per-worker state). Workers pull the next index from
+// a shared counter, so a worker that finishes a small subtree immediately takes more work
+// instead of waiting on a fixed partition.
+template<typename F>
+void parallelForWorkers(size_t count, unsigned threads, F&& fn) {
+    std::atomic<size_t> next{0};
+    auto worker = [&](unsigned id) {
+        for (size_t i = next++; i < count; i = next++)
+            fn(i, id);
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < workerCount(count, threads); t++)
+        pool.emplace_back(worker, t);
+    worker(0);
+    for (auto& thread : pool)
+        thread.join();
+}
+
+// Runs fn(i) for every i in [0, count) on `threads` workers.
+template<typename F>
+void parallelFor(size_t count, unsigned threads, F&& fn) {
+    parallelForWorkers(count, threads, [&](size_t i, unsigned) { fn(i); });
+}
+
+// One unit of the split hierarchy: a single instance met above the split depth, or a whole
+// subtree below it. Slots are kept in traversal order so merged results match the serial walk.
+struct TraversalSlot {
+    const Symbol* instance = nullptr;
+    const Scope* subtree = nullptr;
+};
+
+void planTraversal(const Scope& scope, int depth, std::vector<TraversalSlot>& slots) {
+    for (auto& member : scope.members()) {
+        if (member.kind == SymbolKind::Instance) {
+            const auto& instance = member.as<InstanceSymbol>();
+            slots.push_back({&instance, nullptr});
+            if (depth > 0)
+                planTraversal(instance.body, depth - 1, slots);
+            else
+                slots.push_back({nullptr, &instance.body});
+        }
+        else if (member.kind == SymbolKind::UninstantiatedDef) {
+            slots.push_back({&member, nullptr});
+        }
+        else if (member.isScope()) {
+            planTraversal(member.as<Scope>(), depth, slots);
+        }
+    }
+}
+
+} // namespace
+
+void prepareParallelCollection(Compilation& compilation) {
+    compilation.getAllDiagnostics();
+    compilation.freeze();
+}
+
+namespace {
+
+// The instance tree split into slots, each with its own index, and the positions in each
+// slot's index matching each query.
+struct ParallelIndex {
+    std::vector<TraversalSlot> slots;
+    std::vector<InstanceIndex> indexes;
+    std::vector<std::vector<std::vector<uint32_t>>> selected;
+};
+
+// First half of the parallel collection: splits the walked hierarchy (the whole design, or the
+// subtree of `scope`) across a thread pool and indexes each slot.
+ParallelIndex indexParallel(const RootSymbol& root, const InstanceSymbol* scope,
+                            QuerySet& queries, unsigned threads, RunStats* stats) {
+    // Split deep enough that there are several subtrees per worker to balance the load.
+    ParallelIndex index;
+    auto& slots = index.slots;
+    for (int depth = 0; depth < 8; depth++) {
+        slots.clear();
+        if (scope) {
+            slots.push_back({scope, nullptr});
+            planTraversal(scope->body, depth, slots);
+        }
+        else {
+            planTraversal(root, depth, slots);
+        }
+        size_t subtrees = std::count_if(slots.begin(), slots.end(),
+                                        [](const TraversalSlot& slot) { return slot.subtree; });
+        if (subtrees >= size_t(threads) * 8)
+            break;
+    }
+
+    // Phase 1 (parallel): index each slot.
+    auto& indexes = index.indexes;
+    indexes.resize(slots.size());
+    parallelFor(slots.size(), threads, [&](size_t i) {
+        if (slots[i].subtree)
+            indexes[i].build(*slots[i].subtree);
+        else
+            indexes[i].record(*slots[i].instance);
+    });
+    if (stats) {
+        for (const auto& slotIndex : indexes) {
+            stats->count("symbolsVisited", slotIndex.symbolsVisited());
+            stats->count("instancesVisited", slotIndex.instances().size());
+        }
+    }
+
+    // Phase 2 (serial): resolve queries, which mutates the QuerySet's match cache, and bind any
+    // port connections that elaboration left lazy.
+    index.selected.resize(slots.size());
+    for (size_t i = 0; i < slots.size(); i++) {
+        index.selected[i] = selectInstances(indexes[i], queries);
+        for (const auto& positions : index.selected[i]) {
+            for (uint32_t pos : positions) {
+                const Symbol& symbol = *indexes[i].instances()[pos];
+                if (symbol.kind == SymbolKind::Instance)
+                    symbol.as<InstanceSymbol>().getPortConnections();
+                else
+                    symbol.as<UninstantiatedDefSymbol>().getPortConnections();
+            }
+        }
+    }
+    return index;
+}
+
+// Same results as collectInstantiationsInAST, produced from an indexParallel() split. Each slot
+// gets its own result buffers; buffers are merged in slot order.
+void collectInstantiationsParallel(ParallelIndex& index, std::vector<InspectorResult>& results,
+                                   ResultSink* sink, unsigned threads, FieldSet fields,
+                                   const LibertyDatabase* liberty) {
+    const auto& indexes = index.indexes;
+    const auto& selected = index.selected;
+
+    // Phase 3 (parallel): build the InstanceInfos into per-slot buffers, with one builder (and
+    // its memoized strings) per worker.
+    auto directions = buildDirectionTables(results);
+    std::vector<std::vector<std::vector<InstanceInfo>>> buffers(indexes.size());
+    std::vector<InfoBuilder> builders;
+    for (unsigned w = 0; w < workerCount(indexes.size(), threads); w++)
+        builders.emplace_back(fields, liberty);
+    parallelForWorkers(indexes.size(), threads, [&](size_t i, unsigned worker) {
+        buffers[i].resize(results.size());
+        for (size_t q = 0; q < results.size(); q++) {
+            for (uint32_t pos : selected[i][q]) {
+                buffers[i][q].push_back(
+                    builders[worker].instance(*indexes[i].instances()[pos], directions));
+            }
+        }
+    });
+
+    // Merge in query order, then slot order: identical to the serial output.
+    for (size_t q = 0; q < results.size(); q++) {
+        for (auto& buffer : buffers) {
+            for (auto& info : buffer[q]) {
+                if (sink)
+                    sink->instance(q, std::move(info));
+                else
+                    results[q].instances.push_back(std::move(info));
+            }
+        }
+    }
+}
+
+} // namespace
+
+// ==========================================
+// Syntax-Only Collection (--syntax-only)
+// ==========================================
+
+namespace {
+
+std::string_view trimWhitespace(std::string_view text) {
+    size_t first = text.find_first_not_of(" \t\r\n");
+    if (first == std::string_view::npos)
+        return {};
+    size_t last = text.find_last_not_of(" \t\r\n");
+    return text.substr(first, last - first + 1);
+}
+
+// Results found in one syntax tree, per query, in source order.
+struct SyntaxScanResult {
+    std::vector<std::optional<DefinitionInfo>> definitions;
+    std::vector<std::vector<InstanceInfo>> instances;
+};
+
+// Collects instantiations and module headers from a single syntax tree, with no elaboration:
+// names, connection expressions and source ranges come straight from the syntax. Widths are not
+// computed; port directions are taken from ANSI/non-ANSI port declarations of matching modules.
+class SyntaxInstanceCollector : public SyntaxVisitor<SyntaxInstanceCollector> {
+public:
+    SyntaxInstanceCollector(const QuerySet& queries, SyntaxScanResult& result) :
+        queries(queries), result(result) {
+        result.definitions.resize(queries.queries().size());
+        result.instances.resize(queries.queries().size());
+    }
+
+    void handle(const ModuleDeclarationSyntax& syntax) {
+        std::string_view name = syntax.header->name.valueText();
+        const auto& matches = match(name);
+
+        // Module declarations can nest; keep the enclosing context.
+        auto savedModule = currentModule;
+        auto savedDefinition = currentDefinition;
+        currentModule = name;
+        currentDefinition.reset();
+        if (!matches.empty()) {
+            currentDefinition.emplace();
+            currentDefinition->name = std::string(name);
+            collectPorts(syntax);
+        }
+
+        visitDefault(syntax);
+
+        if (currentDefinition) {
+            for (size_t q : matches) {
+                if (!result.definitions[q])
+                    result.definitions[q] = *currentDefinition;
+            }
+        }
+        currentModule = savedModule;
+        currentDefinition = std::move(savedDefinition);
+    }
+
+    void handle(const HierarchyInstantiationSyntax& syntax) {
+        std::string_view defName = syntax.type.valueText();
+        const auto& matches = match(defName);
+        if (matches.empty() && !currentDefinition)
+            return;
+
+        for (auto instance : syntax.instances) {
+            InstanceInfo info = buildInstance(defName, *instance);
+            if (currentDefinition)
+                currentDefinition->instances.push_back(info);
+            for (size_t q : matches)
+                result.instances[q].push_back(info);
+        }
+    }
+
+private:
+    const QuerySet& queries;
+    SyntaxScanResult& result;
+    std::unordered_map<std::string_view, std::vector<size_t>> matchCache;
+    std::string_view currentModule;
+    std::optional<DefinitionInfo> currentDefinition;
+
+    const std::vector<size_t>& match(std::string_view name) {
+        auto it = matchCache.find(name);
+        if (it != matchCache.end())
+            return it->second;
+        return matchCache.emplace(name, queries.resolve(name)).first->second;
+    }
+
+    static std::string syntaxDirection(Token direction) {
+        switch (direction.kind) {
+            case TokenKind::InputKeyword:
+                return "Input";
+            case TokenKind::OutputKeyword:
+                return "Output";
+            case TokenKind::InOutKeyword:
+                return "Inout";
+            case TokenKind::RefKeyword:
+                return "Ref";
+            default:
+                return {};
+        }
+    }
+
+    // Direction and type text of a port header; an empty direction means "same as previous".
+    static std::pair<std::string, std::string> describeHeader(const PortHeaderSyntax& header) {
+        if (header.kind == SyntaxKind::VariablePortHeader) {
+            const auto& var = header.as<VariablePortHeaderSyntax>();
+            return {syntaxDirection(var.direction),
+                    std::string(trimWhitespace(var.dataType->toString()))};
+        }
+        if (header.kind == SyntaxKind::NetPortHeader) {
+            const auto& net = header.as<NetPortHeaderSyntax>();
+            return {syntaxDirection(net.direction),
+                    std::string(trimWhitespace(net.dataType->toString()))};
+        }
+        return {};
+    }
+
+    void addPort(std::string_view name, std::pair<std::string, std::string> dirAndType,
+                 std::string& lastDirection) {
+        if (dirAndType.first.empty())
+            dirAndType.first = lastDirection.empty() ? "Unknown" : lastDirection;
+        lastDirection = dirAndType.first;
+
+        // A non-ANSI "input a;" completes a port already listed by name in the header.
+        for (auto& port : currentDefinition->ports) {
+            if (port.name == name) {
+                port.direction = dirAndType.first;
+                port.type = dirAndType.second;
+                return;
+            }
+        }
+        currentDefinition->ports.push_back(
+            {std::string(name), dirAndType.first, dirAndType.second});
+    }
+
+    void collectPorts(const ModuleDeclarationSyntax& syntax) {
+        std::string lastDirection;
+        const PortListSyntax* portList = syntax.header->ports;
+        if (portList && portList->kind == SyntaxKind::AnsiPortList) {
+            for (auto port : portList->as<AnsiPortListSyntax>().ports) {
+                if (port->kind != SyntaxKind::ImplicitAnsiPort)
+                    continue;
+                const auto& ansi = port->as<ImplicitAnsiPortSyntax>();
+                addPort(ansi.declarator->name.valueText(), describeHeader(*ansi.header),
+                        lastDirection);
+            }
+        }
+
+        for (auto member : syntax.members) {
+            if (member->kind != SyntaxKind::PortDeclaration)
+                continue;
+            const auto& decl = member->as<PortDeclarationSyntax>();
+            auto dirAndType = describeHeader(*decl.header);
+            for (auto declarator : decl.declarators)
+                addPort(declarator->name.valueText(), dirAndType, lastDirection);
+        }
+    }
+
+    InstanceInfo buildInstance(std::string_view defName, const HierarchicalInstanceSyntax& syntax) {
+        InstanceInfo info;
+        info.definitionName = std::string(defName);
+        if (syntax.decl)
+            info.instanceName = std::string(syntax.decl->name.valueText());
+        info.fullPath = std::string(currentModule) + "." + info.instanceName;
+
+        SourceRange range = syntax.sourceRange();
+        info.startOffset = range.start().offset();
+        info.endOffset = range.end().offset();
+
+        size_t position = 0;
+        for (auto conn : syntax.connections) {
+            ConnectionInfo connInfo;
+            connInfo.isConnected = false;
+            connInfo.signalType = "Unconnected";
+
+            const PropertyExprSyntax* expr = nullptr;
+            if (conn->kind == SyntaxKind::NamedPortConnection) {
+                const auto& named = conn->as<NamedPortConnectionSyntax>();
+                connInfo.portName = std::string(named.name.valueText());
+                expr = named.expr;
+                if (!named.openParen) {
+                    // Implicit ".name" connects to the signal of the same name.
+                    connInfo.signalType = connInfo.portName;
+                    connInfo.isConnected = true;
+                }
+            }
+            else if (conn->kind == SyntaxKind::WildcardPortConnection) {
+                connInfo.portName = ".*";
+                connInfo.signalType = ".*";
+                connInfo.isConnected = true;
+            }
+            else {
+                connInfo.portName = "[Positional #" + std::to_string(position) + "]";
+                if (conn->kind == SyntaxKind::OrderedPortConnection)
+                    expr = conn->as<OrderedPortConnectionSyntax>().expr;
+            }
+            position++;
+
+            if (expr) {
+                connInfo.signalType = std::string(trimWhitespace(expr->toString()));
+                connInfo.isConnected = true;
+            }
+            connInfo.direction = "Unknown";
+            info.connections.push_back(std::move(connInfo));
+        }
+        return info;
+    }
+};
+
+} // namespace
+
+std::vector<InspectorResult> collectFromSyntax(const std::vector<std::shared_ptr<SyntaxTree>>& trees,
+                                               const std::vector<std::string>& names,
+                                               unsigned threads, const LibertyDatabase* liberty) {
+    QuerySet queries(names);
+    std::vector<SyntaxScanResult> scans(trees.size());
+    parallelFor(trees.size(), threads, [&](size_t i) {
+        SyntaxInstanceCollector collector(queries, scans[i]);
+        trees[i]->root().visit(collector);
+    });
+
+    std::vector<InspectorResult> results(names.size());
+    for (auto& scan : scans) {
+        for (size_t q = 0; q < results.size(); q++) {
+            if (scan.definitions[q] && !results[q].definition)
+                results[q].definition = std::move(scan.definitions[q]);
+        }
+    }
+
+    // Fill blackbox directions from any definitions that were found, then directions and widths
+    // of library cells from --liberty.
+    auto directions = buildDirectionTables(results);
+    for (auto& scan : scans) {
+        for (size_t q = 0; q < results.size(); q++) {
+            for (auto& info : scan.instances[q]) {
+                if (auto table = findDirections(directions, info.definitionName)) {
+                    for (auto& conn : info.connections) {
+                        auto it = table->find(conn.portName);
+                        if (it != table->end())
+                            conn.direction = std::string(it->second);
+                    }
+                }
+                if (auto cell = liberty ? liberty->findCell(info.definitionName)
+                                        : LibertyDatabase::Cell()) {
+                    for (auto& conn : info.connections) {
+                        auto pin = cell.pin(conn.portName);
+                        if (!pin)
+                            continue;
+                        if (conn.direction == "Unknown")
+                            conn.direction = std::string(pin->direction);
+                        if (conn.isConnected && pin->width)
+                            conn.width = libertyWidth(pin->width);
+                    }
+                }
+                results[q].instances.push_back(std::move(info));
+            }
+        }
+    }
+    return results;
+}
+
+// ==========================================
+// Query Execution
+// ==========================================
+
+const InstanceSymbol* findScope(Compilation& compilation, std::string_view path) {
+    auto symbol = compilation.getRoot().lookupName(path);
+    if (!symbol || symbol->kind != SymbolKind::Instance)
+        return nullptr;
+    return &symbol->as<InstanceSymbol>();
+}
+
+namespace {
+
+// A definition without the port names that were only kept for the direction lookup.
+DefinitionInfo withRequestedPortFields(DefinitionInfo defInfo, const InfoBuilder& builder) {
+    if (!builder.has(Field::Name)) {
+        for (auto& port : defInfo.ports)
+            port.name.clear();
+    }
+    return defInfo;
+}
+
+} // namespace
+
+std::vector<InspectorResult> runQueries(Compilation& compilation,
+                                        const std::vector<std::string>& names,
+                                        ResultSink* sink, const CollectOptions& options) {
+    QuerySet queries(names);
+    std::vector<InspectorResult> results(names.size());
+    InfoBuilder builder(options.fields, options.liberty);
+    RunStats* stats = options.stats;
+
+    const InstanceSymbol* scope = nullptr;
+    if (!options.scope.empty()) {
+        scope = findScope(compilation, options.scope);
+        if (!scope)
+            throw std::invalid_argument("no instance at scope '" + options.scope + "'");
+    }
+
+    // Index the walked hierarchy first, so definitions can be taken from instances it met.
+    // Definitions alone are answered without it unless the compilation is frozen, where the
+    // definition table cannot create instances.
+    bool walk = options.instances || compilation.isFrozen();
+    bool parallel = walk && options.threads > 1;
+    InstanceIndex index;
+    ParallelIndex split;
+    if (walk) {
+        RunStats::Phase phase(stats, "collectInstances");
+        if (parallel) {
+            split = indexParallel(compilation.getRoot(), scope, queries, options.threads, stats);
+        }
+        else {
+            if (scope) {
+                index.record(*scope);
+                index.build(scope->body);
+            }
+            else {
+                index.build(compilation.getRoot());
+            }
+            if (stats) {
+                stats->count("symbolsVisited", index.symbolsVisited());
+                stats->count("instancesVisited", index.instances().size());
+            }
+        }
+    }
+
+    // Collect Definition
+    {
+        RunStats::Phase phase(stats, "collectModule");
+        auto indexes = parallel ? std::span<const InstanceIndex>(split.indexes)
+                                : std::span<const InstanceIndex>(&index, 1);
+        collectDefinitions(compilation, scope, indexes, queries, results, builder);
+        if (sink) {
+            for (size_t q = 0; q < results.size(); q++) {
+                if (results[q].definition)
+                    sink->definition(q, withRequestedPortFields(*results[q].definition, builder));
+            }
+        }
+    }
+
+    // Collect Instantiations
+    if (options.instances) {
+        RunStats::Phase phase(stats, "collectInstances");
+        if (parallel) {
+            collectInstantiationsParallel(split, results, sink, options.threads, options.fields,
+                                          options.liberty);
+        }
+        else {
+            collectInstantiationsInAST(index, queries, results, sink, builder);
+        }
+    }
+
+    for (auto& result : results) {
+        if (result.definition)
+            result.definition = withRequestedPortFields(std::move(*result.definition), builder);
+    }
+    return results;
+}
+
+// ==========================================
+// Design Loading
+// ==========================================
+
+uint64_t hashBytes(std::string_view bytes, uint64_t hash) {
+    for (char c : bytes) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint64_t hashFile(const std::filesystem::path& path) {
+    uint64_t hash = FnvOffsetBasis;
+    std::ifstream in(path, std::ios::binary);
+    char buffer[1 << 16];
+    while (in) {
+        in.read(buffer, sizeof(buffer));
+        hash = hashBytes(std::string_view(buffer, static_cast<size_t>(in.gcount())), hash);
+    }
+    return hash;
+}
+
+SourceStamp stampFile(const std::filesystem::path& path) {
+    std::error_code ec;
+    SourceStamp stamp;
+    stamp.path = path;
+    stamp.mtime = std::filesystem::last_write_time(path, ec);
+    stamp.size = std::filesystem::file_size(path, ec);
+    stamp.hash = hashFile(path);
+    return stamp;
+}
+
+std::vector<SourceStamp> stampSources(const SourceManager& sourceManager) {
+    std::vector<SourceStamp> stamps;
+    std::set<std::filesystem::path> seen;
+    for (BufferID buffer : sourceManager.getAllBuffers()) {
+        const auto& path = sourceManager.getFullPath(buffer);
+        if (path.empty() || !seen.insert(path).second)
+            continue;
+        stamps.push_back(stampFile(path));
+    }
+    return stamps;
+}
+
+std::vector<SourceStamp> stampInputs(std::span<const char* const> args,
+                                     const SourceManager& sourceManager) {
+    auto stamps = stampSources(sourceManager);
+    for (size_t i = 1; i + 1 < args.size(); i++) {
+        std::string_view arg = args[i];
+        if (arg == "-f" || arg == "-F") {
+            std::error_code ec;
+            stamps.push_back(stampFile(std::filesystem::absolute(args[++i], ec)));
+        }
+    }
+    return stamps;
+}
+
+bool sourcesChanged(std::vector<SourceStamp>& stamps) {
+    for (auto& stamp : stamps) {
+        std::error_code ec;
+        auto mtime = std::filesystem::last_write_time(stamp.path, ec);
+        if (ec)
+            return true;
+        auto size = std::filesystem::file_size(stamp.path, ec);
+        if (ec || size != stamp.size)
+            return true;
+        if (mtime == stamp.mtime)
+            continue;
+        if (hashFile(stamp.path) != stamp.hash)
+            return true;
+        stamp.mtime = mtime;
+    }
+    return false;
+}
+
+bool parseSources(Driver& driver) {
+    if (!driver.processOptions())
+        return false;
+
+    if (!driver.parseAllSources()) {
+        std::cerr << "Error loading file." << '\n';
+        return false;
+    }
+    return true;
+}
+
+bool elaborateDesign(std::unique_ptr<Driver> driver, LoadedDesign& design, RunStats* stats) {
+    {
+        RunStats::Phase phase(stats, "parse");
+        if (!parseSources(*driver))
+            return false;
+    }
+    if (stats)
+        stats->count("syntaxTrees", driver->syntaxTrees.size());
+
+    RunStats::Phase phase(stats, "elaborate");
+    design.compilation = driver->createCompilation();
+    design.driver = std::move(driver);
+    if (stats) {
+        // Elaboration is lazy; build the top of the hierarchy here so it is not attributed to
+        // the first collection phase. Deeper bodies are still elaborated on first visit.
+        design.compilation->getRoot();
+    }
+    return true;
+}
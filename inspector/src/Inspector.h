@@ -0,0 +1,418 @@
+// Inspector core: answers module/definition queries over a slang design. Shared by the
+// inspector executable and the slang_inspector Python module.
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "slang/ast/Compilation.h"
+#include "slang/ast/SemanticFacts.h"
+#include "slang/diagnostics/Diagnostics.h"
+#include "slang/driver/Driver.h"
+#include "slang/syntax/SyntaxTree.h"
+#include "slang/text/SourceManager.h"
+
+// ==========================================
+// Data Structures for Results
+// ==========================================
+
+struct PortInfo {
+    std::string name;
+    std::string direction;
+    std::string type;
+};
+
+struct ConnectionInfo {
+    std::string portName;
+    std::string signalType;
+    std::string width;
+    std::string direction;
+    bool isConnected;
+};
+
+struct InstanceInfo {
+    std::string instanceName;
+    std::string fullPath;
+    std::string definitionName;
+    std::vector<ConnectionInfo> connections;
+    unsigned int startOffset = 0;
+    unsigned int endOffset = 0;
+};
+
+struct DefinitionInfo {
+    std::string name;
+    std::vector<PortInfo> ports;
+    std::vector<InstanceInfo> instances;
+};
+
+struct InspectorResult {
+    // For a glob matching several definitions, the first one found.
+    std::optional<DefinitionInfo> definition;
+    std::vector<InstanceInfo> instances;
+};
+
+// JSON Serialization
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(PortInfo, name, direction, type)
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(ConnectionInfo, portName, signalType, width, direction,
+                                   isConnected)
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(InstanceInfo, instanceName, fullPath, definitionName,
+                                   connections, startOffset, endOffset)
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(DefinitionInfo, name, ports, instances)
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(InspectorResult, definition, instances)
+
+// Help function: Convert ArgumentDirection to string
+std::string directionToString(slang::ast::ArgumentDirection dir);
+
+// ==========================================
+// Run Statistics (--stats)
+// ==========================================
+
+// Peak resident set size of this process, in bytes.
+uint64_t peakRssBytes();
+
+// User + system CPU time of this process (all threads), in seconds.
+double processCpuSeconds();
+
+struct PhaseTiming {
+    std::string name;
+    double wallSeconds = 0;
+    double cpuSeconds = 0;
+};
+
+// Per-phase timings and counters of one run, written as JSON with --stats.
+class RunStats {
+public:
+    // Times its own lifetime as one phase; with a null RunStats it does nothing.
+    class Phase {
+    public:
+        Phase(RunStats* stats, std::string_view name) :
+            stats(stats), name(name), start(std::chrono::steady_clock::now()),
+            cpuStart(stats ? processCpuSeconds() : 0) {}
+        Phase(const Phase&) = delete;
+        Phase& operator=(const Phase&) = delete;
+
+        ~Phase() {
+            if (stats) {
+                std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+                stats->add(name, wall.count(), processCpuSeconds() - cpuStart);
+            }
+        }
+
+    private:
+        RunStats* stats;
+        std::string_view name;
+        std::chrono::steady_clock::time_point start;
+        double cpuStart;
+    };
+
+    // Phases entered more than once accumulate.
+    void add(std::string_view name, double wallSeconds, double cpuSeconds);
+
+    // A named counter; the reference stays valid for the lifetime of the RunStats.
+    uint64_t& counter(std::string_view name);
+
+    void count(std::string_view name, uint64_t n) { counter(name) += n; }
+
+    void countDiagnostics(const slang::Diagnostics& diags);
+
+    nlohmann::json toJson() const;
+
+private:
+    std::vector<PhaseTiming> phases;
+    std::map<std::string, uint64_t, std::less<>> counters;
+};
+
+void countResults(RunStats& stats, const std::vector<InspectorResult>& results);
+
+// Forces the remaining semantic checks, so it is timed as a phase of its own.
+void countCompilationDiagnostics(RunStats& stats, slang::ast::Compilation& compilation);
+
+// ==========================================
+// Field Projection (--fields)
+// ==========================================
+
+enum class Field : uint32_t {
+    Name = 1 << 0,       // instanceName, portName
+    Path = 1 << 1,       // fullPath
+    Definition = 1 << 2, // definitionName
+    Offsets = 1 << 3,    // startOffset, endOffset
+    Signal = 1 << 4,     // signalType (connections), type (definition ports)
+    Width = 1 << 5,      // width
+    Direction = 1 << 6,  // direction
+};
+
+// The result fields to compute. Fields outside the set keep their default (empty) values and
+// are never computed.
+class FieldSet {
+public:
+    static FieldSet all() { return FieldSet(~0u); }
+
+    // Parses a comma separated list such as "name,offsets,direction".
+    static std::optional<FieldSet> parse(std::string_view list);
+
+    bool has(Field field) const { return (mask & uint32_t(field)) != 0; }
+
+private:
+    explicit FieldSet(uint32_t mask) : mask(mask) {}
+    uint32_t mask;
+};
+
+// ==========================================
+// Liberty Pin Database (--liberty)
+// ==========================================
+
+// A read-only mapping of a whole file.
+class MappedFile {
+public:
+    static std::optional<MappedFile> open(const std::filesystem::path& path);
+
+    MappedFile() = default;
+    MappedFile(MappedFile&& other) noexcept : bytes(std::exchange(other.bytes, {})) {}
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        std::swap(bytes, other.bytes);
+        return *this;
+    }
+    ~MappedFile();
+
+    std::string_view data() const { return bytes; }
+
+private:
+    std::string_view bytes;
+};
+
+enum class LibertyDirection : uint8_t { Unknown, Input, Output, Inout };
+
+// Same spelling as directionToString, so Liberty and elaborated directions compare equal.
+std::string_view libertyDirectionName(LibertyDirection direction);
+
+// On-disk index layout: header, cell records sorted by name, pin records (each cell's pins
+// contiguous and sorted by name), then the name bytes. Records are fixed size and naturally
+// aligned, so a mapping of the file is used in place. Multi-byte fields are native endian; a
+// file from a machine of the other byte order fails the version check and is rebuilt.
+struct LibertyIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t cellCount;
+    uint32_t pinCount;
+    uint32_t reserved;
+    uint64_t sourceSize; // of the Liberty file the index was built from
+    int64_t sourceMtime; // ditto, in file_time_type ticks
+    uint64_t nameBytes;
+};
+
+struct LibertyCellRecord {
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t firstPin;
+    uint32_t pinCount;
+};
+
+struct LibertyPinRecord {
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t width;
+    uint8_t direction;
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(LibertyIndexHeader) == 48 && sizeof(LibertyCellRecord) == 16 &&
+              sizeof(LibertyPinRecord) == 16);
+
+struct LibertyPinInfo {
+    std::string_view direction;
+    uint32_t width; // 0 if unknown
+};
+
+// The index of one Liberty file: a read-only view over the serialized bytes, either mapped from
+// the persisted index file or just built in memory. Lookups are binary searches over the cell
+// records, then over the cell's pins.
+class LibertyIndex {
+public:
+    static constexpr char Magic[8] = {'I', 'N', 'S', 'P', 'L', 'I', 'B', '\n'};
+    static constexpr uint32_t FormatVersion = 1;
+
+    // Wraps serialized bytes if they are a complete index of the given source revision.
+    static std::optional<LibertyIndex> open(std::string_view bytes, uint64_t sourceSize,
+                                            int64_t sourceMtime);
+
+    size_t cellCount() const { return cells.size(); }
+
+    const LibertyCellRecord* findCell(std::string_view name) const;
+
+    std::optional<LibertyPinInfo> findPin(const LibertyCellRecord& cell,
+                                          std::string_view name) const;
+
+private:
+    std::span<const LibertyCellRecord> cells;
+    std::span<const LibertyPinRecord> pins;
+    std::string_view names;
+
+    template<typename Record>
+    std::string_view name(const Record& record) const {
+        if (uint64_t(record.nameOffset) + record.nameLength > names.size())
+            return {};
+        return names.substr(record.nameOffset, record.nameLength);
+    }
+};
+
+// The per-user cache directory for derived files such as Liberty indexes:
+// $XDG_CACHE_HOME/slang-inspector, else ~/.cache/slang-inspector, else under the temp directory.
+std::string defaultCacheDir();
+
+// Pin directions and widths of the cells of one or more Liberty files, used for blackbox
+// instances. Each file has its own persisted index, an entry of `indexDir` or, without one,
+// `<file>.pinidx` beside the library; an index that is current for its source is mapped and used
+// in place, so loading costs a stat and an mmap per file. Missing or stale indexes are rebuilt
+// from the Liberty source. Earlier files take precedence when several define the same cell.
+class LibertyDatabase {
+public:
+    // A cell found in one of the indexes; converts to false if not found.
+    class Cell {
+    public:
+        Cell() = default;
+        Cell(const LibertyIndex* index, const LibertyCellRecord* record) :
+            index(index), record(record) {}
+
+        explicit operator bool() const { return record != nullptr; }
+
+        std::optional<LibertyPinInfo> pin(std::string_view name) const {
+            return record ? index->findPin(*record, name) : std::nullopt;
+        }
+
+    private:
+        const LibertyIndex* index = nullptr;
+        const LibertyCellRecord* record = nullptr;
+    };
+
+    // Returns false with `error` set if a Liberty file cannot be read or parsed. Failing to
+    // write an index is not an error; the index just built is used from memory.
+    bool load(const std::vector<std::string>& paths, const std::optional<std::string>& indexDir,
+              std::string& error);
+
+    Cell findCell(std::string_view name) const;
+
+    bool empty() const { return indexes.empty(); }
+
+    size_t cellCount() const;
+
+    size_t indexesBuilt() const { return rebuilt; }
+
+private:
+    std::vector<MappedFile> mappings;
+    std::vector<std::unique_ptr<std::string>> built;
+    std::vector<LibertyIndex> indexes; // views into mappings / built
+    size_t rebuilt = 0;
+};
+
+// ==========================================
+// Query Execution
+// ==========================================
+
+// Receives results as they are found. Without a sink, instances are accumulated into
+// InspectorResult::instances; a streaming sink writes them out instead so the full result set is
+// never held in memory.
+class ResultSink {
+public:
+    virtual ~ResultSink() = default;
+    virtual void definition(size_t query, const DefinitionInfo& def) = 0;
+    virtual void instance(size_t query, InstanceInfo&& info) = 0;
+};
+
+struct CollectOptions {
+    unsigned threads = 1;
+    FieldSet fields = FieldSet::all();
+    RunStats* stats = nullptr;
+    const LibertyDatabase* liberty = nullptr;
+    std::string scope; // hierarchical path of the instance to walk (--scope); empty for all
+    bool instances = true; // false: answer definitions only (--definitions-only)
+};
+
+// The instance at a hierarchical path such as "top.u_mem.u_bank"; elaborates only the bodies
+// along the path. Null if there is no instance there.
+const slang::ast::InstanceSymbol* findScope(slang::ast::Compilation& compilation,
+                                            std::string_view path);
+
+// Answers every query from one traversal of an already elaborated design, or of the subtree of
+// options.scope (std::invalid_argument if there is no such instance). Definitions are found
+// among the instances walked and, failing that, in the compilation's definition table.
+// Without options.instances there is no traversal: definitions come from the tops (or the scope
+// instance) and the definition table alone, so only their own bodies are elaborated; a frozen
+// compilation is still walked. With threads > 1 the compilation must have been through
+// prepareParallelCollection().
+std::vector<InspectorResult> runQueries(slang::ast::Compilation& compilation,
+                                        const std::vector<std::string>& names,
+                                        ResultSink* sink = nullptr,
+                                        const CollectOptions& options = {});
+
+// Elaborates everything up front and freezes the compilation, so the parallel walk below only
+// reads it.
+void prepareParallelCollection(slang::ast::Compilation& compilation);
+
+// Answers queries from syntax trees alone. Trees are independent, so they are scanned in
+// parallel and merged in tree order.
+std::vector<InspectorResult> collectFromSyntax(
+    const std::vector<std::shared_ptr<slang::syntax::SyntaxTree>>& trees,
+    const std::vector<std::string>& names, unsigned threads,
+    const LibertyDatabase* liberty = nullptr);
+
+// ==========================================
+// Design Loading
+// ==========================================
+
+// FNV-1a; used for source change detection and result cache keys.
+constexpr uint64_t FnvOffsetBasis = 0xcbf29ce484222325ull;
+
+uint64_t hashBytes(std::string_view bytes, uint64_t hash = FnvOffsetBasis);
+
+// Cheap enough to confirm whether a touched file really changed.
+uint64_t hashFile(const std::filesystem::path& path);
+
+// Identity of one loaded source file, used to notice edits between requests.
+struct SourceStamp {
+    std::filesystem::path path;
+    std::filesystem::file_time_type mtime;
+    uintmax_t size = 0;
+    uint64_t hash = 0;
+};
+
+SourceStamp stampFile(const std::filesystem::path& path);
+
+// A parsed and elaborated design. The compilation references the driver's SourceManager and
+// syntax trees, so it is declared after the driver and destroyed first. Sources are only stamped
+// by the modes that need to detect edits.
+struct LoadedDesign {
+    std::unique_ptr<slang::driver::Driver> driver;
+    std::unique_ptr<slang::ast::Compilation> compilation;
+    std::vector<SourceStamp> sources;
+};
+
+std::vector<SourceStamp> stampSources(const slang::SourceManager& sourceManager);
+
+// Stamps of the loaded sources plus the -f/-F filelists named in the argv-style `args` (args[0]
+// is the program); a filelist decides which sources are loaded in the first place.
+std::vector<SourceStamp> stampInputs(std::span<const char* const> args,
+                                     const slang::SourceManager& sourceManager);
+
+// True if any source changed on disk. A file whose mtime moved but whose contents hash the same
+// (e.g. touched by a build step) just has its stamp refreshed.
+bool sourcesChanged(std::vector<SourceStamp>& stamps);
+
+// Parses all sources named on the (already parsed) command line. Source files, filelists (-f),
+// include dirs and defines all go through the slang driver, which parses the resulting buffers
+// concurrently on --threads workers.
+bool parseSources(slang::driver::Driver& driver);
+
+// Parses and elaborates the design named on the command line.
+bool elaborateDesign(std::unique_ptr<slang::driver::Driver> driver, LoadedDesign& design,
+                     RunStats* stats = nullptr);
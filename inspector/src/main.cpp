@@ -1,23 +1,32 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <nlohmann/json.hpp>
 #include <optional>
 #include <set>
+#include <span>
+#include <stdexcept>
+#include <streambuf>
 #include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "Inspector.h"
 #include "slang/ast/Compilation.h"
-#include "slang/ast/EvalContext.h"
-#include "slang/ast/Expression.h"
-#include "slang/ast/expressions/AssertionExpr.h"
-#include "slang/ast/expressions/MiscExpressions.h"
-#include "slang/ast/expressions/SelectExpressions.h"
-#include "slang/ast/symbols/CompilationUnitSymbols.h"
-#include "slang/ast/symbols/InstanceSymbols.h"
-#include "slang/ast/symbols/PortSymbols.h"
-#include "slang/ast/symbols/ValueSymbol.h"
-#include "slang/ast/types/Type.h"
 #include "slang/diagnostics/DiagnosticEngine.h"
 #include "slang/diagnostics/TextDiagnosticClient.h"
 #include "slang/driver/Driver.h"
@@ -32,489 +41,1385 @@ using namespace slang::syntax;
 using json = nlohmann::json;
 
 // ==========================================
-// Data Structures for Results
+// Run Statistics (--stats)
 // ==========================================
 
-struct PortInfo {
-    std::string name;
-    std::string direction;
-    std::string type;
-};
+// Forwards to another stream buffer and counts the bytes written through it.
+class CountingStreamBuf : public std::streambuf {
+public:
+    CountingStreamBuf(std::streambuf* target, uint64_t& bytes) : target(target), bytes(bytes) {}
+
+protected:
+    int_type overflow(int_type ch) override {
+        if (traits_type::eq_int_type(ch, traits_type::eof()))
+            return traits_type::not_eof(ch);
+        bytes++;
+        return target->sputc(traits_type::to_char_type(ch));
+    }
 
-struct ConnectionInfo {
-    std::string portName;
-    std::string signalType;
-    std::string width;
-    std::string direction;
-    bool isConnected;
-};
+    std::streamsize xsputn(const char* data, std::streamsize size) override {
+        auto written = target->sputn(data, size);
+        bytes += uint64_t(written);
+        return written;
+    }
 
-struct InstanceInfo {
-    std::string instanceName;
-    std::string fullPath;
-    std::string definitionName;
-    std::vector<ConnectionInfo> connections;
-    unsigned int startOffset = 0;
-    unsigned int endOffset = 0;
-};
+    int sync() override { return target->pubsync(); }
 
-struct DefinitionInfo {
-    std::string name;
-    std::vector<PortInfo> ports;
-    std::vector<InstanceInfo> instances;
+private:
+    std::streambuf* target;
+    uint64_t& bytes;
 };
 
-struct InspectorResult {
-    std::optional<DefinitionInfo> definition;
-    std::vector<InstanceInfo> instances;
-};
+// ==========================================
+// Print Helper
+// ==========================================
+void printTextOutput(const InspectorResult& result) {
+    if (result.definition) {
+        const auto& def = *result.definition;
+        std::cout << "[Result] Found Definition for '" << def.name << "'" << '\n';
+        std::cout << "--------------------------------------------" << '\n';
+        std::cout << "Source: Full Module Definition (AST)" << '\n';
+        for (const auto& port : def.ports) {
+            std::cout << "  Port: " << port.name << " | Dir: " << port.direction
+                      << " | Type: " << port.type << '\n';
+        }
+        std::cout << "--------------------------------------------" << '\n';
+    }
+
+    if (!result.instances.empty()) {
+        for (const auto& inst : result.instances) {
+            std::cout << "[Result] Found Instantiation (AST) for '" << inst.definitionName << "'"
+                      << '\n';
+            std::cout << "  Instance Name: " << inst.instanceName << '\n';
+            std::cout << "  Full Path: " << inst.fullPath << '\n';
+            std::cout << "--------------------------------------------" << '\n';
+            std::cout << "Source: AST Connection Analysis" << '\n';
 
-// JSON Serialization
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(PortInfo, name, direction, type)
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(ConnectionInfo, portName, signalType, width, direction,
-                                   isConnected)
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(InstanceInfo, instanceName, fullPath, definitionName,
-                                   connections, startOffset, endOffset)
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(DefinitionInfo, name, ports, instances)
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(InspectorResult, definition, instances)
-
-// Help function: Convert ArgumentDirection to string
-std::string directionToString(ArgumentDirection dir) {
-    switch (dir) {
-        case ArgumentDirection::In:
-            return "Input";
-        case ArgumentDirection::Out:
-            return "Output";
-        case ArgumentDirection::InOut:
-            return "Inout";
-        case ArgumentDirection::Ref:
-            return "Ref";
-        default:
-            return "Unknown";
+            for (const auto& conn : inst.connections) {
+                std::cout << "  Port: " << conn.portName << " | Dir: " << conn.direction;
+                if (conn.isConnected) {
+                    std::cout << " | Connected Signal Type: " << conn.signalType
+                              << " | Width: " << conn.width;
+                }
+                else {
+                    std::cout << " | Unconnected";
+                }
+                std::cout << '\n';
+            }
+            std::cout << "--------------------------------------------" << '\n';
+        }
+    }
+    else if (!result.definition) {
+        // Only print if neither was found? The original code printed "AST search yielded no
+        // results." if foundInstances was false. But foundInAST (definition) returned earlier. We
+        // will handle "Not found" in main.
     }
 }
 
 // ==========================================
-// Helper: Infer width from expression
+// Output
 // ==========================================
-std::string inferWidth(const Expression& expr, const Scope& scope) {
-    const Type& type = *expr.type;
-    auto width = type.getBitWidth();
 
-    if (width > 0) {
-        return std::to_string(width);
+// Streams results as newline-delimited JSON: one compact document per definition and per
+// instance, written the moment it is found. Definition lines are wrapped as
+// {"definition": {...}}; instance lines are bare InstanceInfo objects. With several queries
+// each line also carries the "query" it answers.
+class NdjsonWriter : public ResultSink {
+public:
+    NdjsonWriter(std::ostream& out, const std::vector<std::string>* queryNames) :
+        out(out), queryNames(queryNames) {}
+
+    size_t count() const { return written; }
+    size_t instanceCount() const { return instances; }
+    size_t connectionCount() const { return connections; }
+
+    void definition(size_t query, const DefinitionInfo& def) override {
+        json line = {{"definition", def}};
+        write(query, line);
     }
 
-    if (type.toString() != "<error>") {
-        return std::to_string(width);
+    void instance(size_t query, InstanceInfo&& info) override {
+        instances++;
+        connections += info.connections.size();
+        json line = info;
+        write(query, line);
     }
 
-    // For error types, try to infer from expression kind
-    const Expression* targetExpr = &expr;
-
-    // If this is an InvalidExpression, try to unwrap it
-    if (expr.kind == ExpressionKind::Invalid) {
-        const auto& invalidExpr = expr.as<InvalidExpression>();
-        if (invalidExpr.child) {
-            targetExpr = invalidExpr.child;
-        }
+private:
+    std::ostream& out;
+    const std::vector<std::string>* queryNames;
+    size_t written = 0;
+    size_t instances = 0;
+    size_t connections = 0;
+
+    void write(size_t query, json& line) {
+        if (queryNames)
+            line["query"] = (*queryNames)[query];
+        out << line.dump() << '\n';
+        written++;
     }
+};
 
-    // Check if this is a RangeSelect expression (e.g., dat_i[63:0])
-    if (targetExpr->kind == ExpressionKind::RangeSelect) {
-        const auto& rangeExpr = targetExpr->as<RangeSelectExpression>();
-
-        // Try to get width from the type first
-        auto rangeWidth = rangeExpr.type->getBitWidth();
-        if (rangeWidth > 0) {
-            return std::to_string(rangeWidth) + " (inferred from slice)";
+// Encodes a result set for --compact. Deep hierarchies repeat the same path prefixes and, for
+// every copy of a module body, the same connection lists; here every string (path segments,
+// names, types, widths, directions) is stored once in "strings", instance paths are nodes of a
+// tree of [parent, segment] pairs, and identical connection lists (instances of one body and
+// parameterization) are stored once in "connectionSets". Instances are tuples
+// [node, name, definition, connectionSet, startOffset, endOffset], where name is -1 when it
+// equals the node's last segment and node is -1 for an empty path. Connections are
+// [portName, signalType, width, direction, isConnected]. Definitions are written unchanged.
+// The macro_replacer.compact module expands the document back to the regular shape.
+class CompactEncoder {
+public:
+    static constexpr int FormatVersion = 1;
+
+    json encode(const std::vector<std::string>& queryNames,
+                const std::vector<InspectorResult>& results, bool multiQuery) {
+        json encoded = json::array();
+        for (const auto& result : results) {
+            json instances = json::array();
+            for (const auto& info : result.instances)
+                instances.push_back(instance(info));
+            encoded.push_back(
+                {{"definition", result.definition}, {"instances", std::move(instances)}});
         }
 
-        // Try to calculate width from left and right bounds
-        auto& comp = scope.getCompilation();
-        EvalContext evalCtx(comp.getRoot());
+        json strings = json::array();
+        for (const auto& string : stringValues)
+            strings.push_back(string);
+
+        return {{"format", "inspector-compact"},
+                {"version", FormatVersion},
+                {"multiQuery", multiQuery},
+                {"queries", queryNames},
+                {"strings", std::move(strings)},
+                {"nodes", std::move(nodes)},
+                {"connectionSets", std::move(connectionSets)},
+                {"results", std::move(encoded)}};
+    }
 
-        auto leftVal = rangeExpr.left().eval(evalCtx);
-        auto rightVal = rangeExpr.right().eval(evalCtx);
+private:
+    std::deque<std::string> stringValues; // stable storage for the stringIds keys
+    std::unordered_map<std::string_view, uint32_t> stringIds;
+    std::unordered_map<uint64_t, uint32_t> nodeIds; // (parent + 1, segment) -> node
+    std::vector<uint32_t> nodeSegments;
+    std::unordered_map<std::string, uint32_t> connectionSetIds;
+    json nodes = json::array();
+    json connectionSets = json::array();
+
+    uint32_t intern(std::string_view string) {
+        auto it = stringIds.find(string);
+        if (it != stringIds.end())
+            return it->second;
+        uint32_t id = uint32_t(stringValues.size());
+        stringIds.emplace(stringValues.emplace_back(string), id);
+        return id;
+    }
 
-        if (leftVal.isInteger() && rightVal.isInteger()) {
-            int64_t left = leftVal.integer().as<int64_t>().value_or(0);
-            int64_t right = rightVal.integer().as<int64_t>().value_or(0);
-            int64_t calculatedWidth = std::abs(left - right) + 1;
-            return std::to_string(calculatedWidth) + " (calculated from [" + std::to_string(left) +
-                   ":" + std::to_string(right) + "])";
+    // End of the path segment starting at `start`: the next '.' that is not part of an escaped
+    // identifier (which runs from '\' to the next space).
+    static size_t segmentEnd(std::string_view path, size_t start) {
+        bool escaped = false;
+        for (size_t i = start; i < path.size(); i++) {
+            if (path[i] == '\\')
+                escaped = true;
+            else if (path[i] == ' ')
+                escaped = false;
+            else if (path[i] == '.' && !escaped)
+                return i;
         }
-        return "(unable to evaluate slice bounds)";
+        return path.size();
     }
 
-    // Check if this is a NamedValue expression (e.g., addr_i)
-    if (targetExpr->kind == ExpressionKind::NamedValue) {
-        const auto& namedExpr = targetExpr->as<NamedValueExpression>();
-        const ValueSymbol& symbol = namedExpr.symbol;
-        const auto& type = symbol.getType();
-        auto width = type.getBitWidth();
+    int64_t node(std::string_view path) {
+        if (path.empty())
+            return -1;
+
+        int64_t parent = -1;
+        for (size_t start = 0;;) {
+            size_t end = segmentEnd(path, start);
+            uint32_t segment = intern(path.substr(start, end - start));
+            uint64_t key = (uint64_t(parent + 1) << 32) | segment;
+            auto [it, inserted] = nodeIds.try_emplace(key, uint32_t(nodeSegments.size()));
+            if (inserted) {
+                nodes.push_back(json::array({parent, segment}));
+                nodeSegments.push_back(segment);
+            }
+            parent = it->second;
+            if (end == path.size())
+                return parent;
+            start = end + 1;
+        }
+    }
 
-        if (width > 0) {
-            return std::to_string(width) + " (inferred from symbol '" + std::string(symbol.name) +
-                   "')";
+    uint32_t connectionSet(const std::vector<ConnectionInfo>& connections) {
+        std::vector<uint32_t> ids;
+        ids.reserve(connections.size() * 5);
+        for (const auto& conn : connections) {
+            ids.push_back(intern(conn.portName));
+            ids.push_back(intern(conn.signalType));
+            ids.push_back(intern(conn.width));
+            ids.push_back(intern(conn.direction));
+            ids.push_back(conn.isConnected);
         }
-        else {
-            return "(NamedValue symbol '" + std::string(symbol.name) +
-                   "' type: " + type.toString() + ")";
+
+        std::string key(reinterpret_cast<const char*>(ids.data()), ids.size() * sizeof(uint32_t));
+        auto [it, inserted] = connectionSetIds.try_emplace(std::move(key),
+                                                           uint32_t(connectionSets.size()));
+        if (inserted) {
+            json set = json::array();
+            for (size_t i = 0; i < ids.size(); i += 5)
+                set.push_back(
+                    json::array({ids[i], ids[i + 1], ids[i + 2], ids[i + 3], ids[i + 4] != 0}));
+            connectionSets.push_back(std::move(set));
         }
+        return it->second;
     }
 
-    return "(type error, expression kind: " + std::string(toString(targetExpr->kind)) + ")";
+    json instance(const InstanceInfo& info) {
+        int64_t path = node(info.fullPath);
+        int64_t name = intern(info.instanceName);
+        if (path >= 0 && nodeSegments[size_t(path)] == name)
+            name = -1;
+        return json::array({path, name, intern(info.definitionName),
+                            connectionSet(info.connections), info.startOffset, info.endOffset});
+    }
+};
+
+// "-" selects stdout; anything else is opened as a file owned by `file`.
+std::ostream& openOutput(const std::string& path, std::ofstream& file) {
+    if (path == "-")
+        return std::cout;
+    file.open(path, std::ios::binary);
+    return file;
 }
 
 // ==========================================
-// Collect Module Definition
+// Design Loading
 // ==========================================
-void collectModuleInAST(Compilation& compilation, const std::string& targetName,
-                        InspectorResult& result) {
-    const RootSymbol& root = compilation.getRoot();
-
-    for (auto instance : root.topInstances) {
-        if (instance->name == targetName) {
-            DefinitionInfo defInfo;
-            defInfo.name = targetName;
-
-            const InstanceBodySymbol& body = instance->body;
-            for (auto& member : body.members()) {
-                if (member.kind == SymbolKind::Port) {
-                    const auto& port = member.as<PortSymbol>();
-                    PortInfo portInfo;
-                    portInfo.name = std::string(port.name);
-                    portInfo.direction = directionToString(port.direction);
-                    portInfo.type = port.getType().toString();
-                    defInfo.ports.push_back(portInfo);
-                }
-                else if (member.kind == SymbolKind::UninstantiatedDef) {
-                    const auto& uninst = member.as<UninstantiatedDefSymbol>();
-                    InstanceInfo subInst;
-                    subInst.instanceName = std::string(uninst.name);
-                    subInst.definitionName = std::string(uninst.definitionName);
-                    subInst.fullPath = uninst.getHierarchicalPath();
-
-                    const SyntaxNode* syntax = uninst.getSyntax();
-                    if (syntax) {
-                        SourceRange range = syntax->sourceRange();
-                        subInst.startOffset = range.start().offset();
-                        subInst.endOffset = range.end().offset();
-                    }
 
-                    auto portNames = uninst.getPortNames();
-                    auto portExprs = uninst.getPortConnections();
-
-                    for (size_t i = 0; i < portExprs.size(); i++) {
-                        ConnectionInfo connInfo;
-                        if (i < portNames.size() && !portNames[i].empty()) {
-                            connInfo.portName = std::string(portNames[i]);
-                        }
-                        else {
-                            connInfo.portName = "[Positional #" + std::to_string(i) + "]";
-                        }
-
-                        if (portExprs[i]) {
-                            const Expression* expr = nullptr;
-                            if (portExprs[i]->kind == AssertionExprKind::Simple) {
-                                expr = &portExprs[i]->as<SimpleAssertionExpr>().expr;
-                            }
-
-                            if (expr) {
-                                const Type& type = *expr->type;
-                                connInfo.signalType = type.toString();
-                                if (expr->syntax) {
-                                    connInfo.signalType = expr->syntax->toString();
-                                }
-                                connInfo.isConnected = true;
-                            }
-                            else {
-                                connInfo.signalType =
-                                    "Complex/Unresolved"; // Handle Sequence/Property exprs if
-                                                          // needed
-                                connInfo.isConnected = true;
-                            }
-                        }
-                        else {
-                            connInfo.isConnected = false;
-                        }
-                        subInst.connections.push_back(connInfo);
-                    }
-                    defInfo.instances.push_back(subInst);
-                }
-                else if (member.kind == SymbolKind::Instance) {
-                    const auto& inst = member.as<InstanceSymbol>();
-                    InstanceInfo subInst;
-                    subInst.instanceName = std::string(inst.name);
-                    subInst.definitionName = std::string(inst.getDefinition().name);
-                    subInst.fullPath = inst.getHierarchicalPath();
-
-                    const SyntaxNode* syntax = inst.getSyntax();
-                    if (syntax) {
-                        SourceRange range = syntax->sourceRange();
-                        subInst.startOffset = range.start().offset();
-                        subInst.endOffset = range.end().offset();
-                    }
+struct InspectorOptions {
+    std::optional<bool> showHelp;
+    std::optional<std::string> targetModule;
+    std::optional<std::string> jsonOutputFile;
+    std::vector<std::string> queryNames;
+    std::optional<std::string> queryFile;
+    std::optional<bool> serve;
+    std::optional<std::string> socketPath;
+    std::optional<bool> replace;
+    std::optional<std::string> oldMacro;
+    std::optional<std::string> newMacro;
+    std::vector<std::string> portRenames;
+    std::optional<std::string> portMapFile;
+    std::optional<std::string> outPath;
+    std::optional<std::string> format;
+    std::optional<std::string> cacheDir;
+    std::optional<uint32_t> cacheMaxSizeMb;
+    std::optional<uint32_t> cacheMaxAgeDays;
+    std::optional<bool> reportRss;
+    std::optional<bool> syntaxOnly;
+    std::optional<bool> definitionsOnly;
+    std::optional<std::string> statsFile;
+    std::optional<std::string> fields;
+    std::vector<std::string> libertyFiles;
+    std::optional<bool> libertyIndexBeside;
+    std::optional<bool> compact;
+    std::optional<std::string> scope;
+};
 
-                    for (auto conn : inst.getPortConnections()) {
-                        ConnectionInfo connInfo;
-                        connInfo.portName = std::string(conn->port.name);
-
-                        const Expression* expr = conn->getExpression();
-                        if (expr) {
-                            if (expr->syntax) {
-                                connInfo.signalType = expr->syntax->toString();
-                            }
-                            else {
-                                connInfo.signalType = expr->type->toString();
-                            }
-                            connInfo.isConnected = true;
-                        }
-                        else {
-                            connInfo.isConnected = false;
-                        }
-                        subInst.connections.push_back(connInfo);
-                    }
-                    defInfo.instances.push_back(subInst);
+// Creates a slang driver with the standard source options plus the inspector's own.
+std::unique_ptr<Driver> createDriver(InspectorOptions& opts) {
+    auto driver = std::make_unique<Driver>();
+    driver->addStandardArgs();
+
+    auto& cmdLine = driver->cmdLine;
+    cmdLine.add("-h,--help", opts.showHelp, "Display available options");
+    cmdLine.add("--module", opts.targetModule, "Name of the module to inspect", "<name>");
+    cmdLine.add("--json", opts.jsonOutputFile, "Write the result as JSON to <file>", "<file>");
+    cmdLine.add("--query", opts.queryNames,
+                "Module/definition name or glob (e.g. sram_*) to answer; repeatable", "<name>");
+    cmdLine.add("--query-file", opts.queryFile,
+                "JSON file with a list of queries (array, or {\"queries\": [...]})", "<file>");
+    cmdLine.add("--serve", opts.serve,
+                "Keep the design loaded and answer JSON-RPC requests (stdin/stdout by default)");
+    cmdLine.add("--socket", opts.socketPath,
+                "With --serve, listen on this Unix domain socket instead of stdin/stdout",
+                "<path>");
+    cmdLine.add("--replace", opts.replace,
+                "Rewrite every instantiation of --old-macro as --new-macro (no elaboration)");
+    cmdLine.add("--old-macro", opts.oldMacro, "With --replace, the macro to replace", "<name>");
+    cmdLine.add("--new-macro", opts.newMacro, "With --replace, the replacement macro", "<name>");
+    cmdLine.add("--port", opts.portRenames,
+                "With --replace, rename a named port connection; repeatable", "<old>=<new>");
+    cmdLine.add("--port-map", opts.portMapFile,
+                "With --replace, JSON object mapping old port names to new ones", "<file>");
+    cmdLine.add("--out", opts.outPath,
+                "Result file ('-' for stdout); with --replace, the rewritten file (single "
+                "source) or directory (several sources)",
+                "<path>");
+    cmdLine.add("--format", opts.format, "Result format: text, json, ndjson, cbor or msgpack",
+                "<format>");
+    cmdLine.add("--compact", opts.compact,
+                "With --format json/cbor/msgpack, intern paths and strings and share identical "
+                "connection lists (see macro_replacer.compact)");
+    cmdLine.add("--cache-dir", opts.cacheDir,
+                "Reuse results stored in <dir> while the sources and options are unchanged",
+                "<dir>");
+    cmdLine.add("--cache-max-size", opts.cacheMaxSizeMb,
+                "Evict least recently used cache entries above this size (default 1024)", "<MB>");
+    cmdLine.add("--cache-max-age", opts.cacheMaxAgeDays,
+                "Evict cache entries unused for this many days (default 30)", "<days>");
+    cmdLine.add("--report-rss", opts.reportRss, "Print the peak resident set size on exit");
+    cmdLine.add("--syntax-only", opts.syntaxOnly,
+                "Answer queries from the syntax trees alone, skipping elaboration (no widths)");
+    cmdLine.add("--definitions-only", opts.definitionsOnly,
+                "Report only the definitions of the queried modules, skipping the instance walk");
+    cmdLine.add("--stats", opts.statsFile,
+                "Report per-phase timings and counters as JSON to <file>, or to stderr with "
+                "--stats - or a --stats followed by no file",
+                "<file>");
+    cmdLine.add("--fields", opts.fields,
+                "Comma separated result fields to compute: name, path, definition, offsets, "
+                "signal, width, direction (default: all)",
+                "<list>");
+    cmdLine.add("--liberty", opts.libertyFiles,
+                "Liberty library giving pin directions and widths of blackbox cells; repeatable",
+                "<file>");
+    cmdLine.add("--liberty-index-beside", opts.libertyIndexBeside,
+                "Keep each Liberty index next to its library as <file>.pinidx instead of in the "
+                "cache directory");
+    cmdLine.add("--scope", opts.scope,
+                "Only walk the subtree of the instance at this hierarchical path (e.g. "
+                "top.u_mem); combine with --top to elaborate a single top",
+                "<hier.path>");
+    return driver;
+}
+
+// --scope must name an instance of the elaborated design.
+bool validScope(Compilation& compilation, const std::optional<std::string>& scope) {
+    if (!scope || findScope(compilation, *scope))
+        return true;
+    std::cerr << "Error: no instance at --scope '" << *scope << "'" << '\n';
+    return false;
+}
+
+// ==========================================
+// Result Cache (--cache-dir)
+// ==========================================
+
+// Content-addressed store of serialized results. An entry is keyed by a hash of the
+// result-affecting arguments and the queries; it records every file the result was computed
+// from (sources, includes, filelists) with its content hash, and is only used if all of them are
+// unchanged. A hit never constructs a Compilation. Entries are evicted by age, then oldest-first
+// by last use until the directory is under its size budget.
+class ResultCache {
+public:
+    static constexpr int FormatVersion = 1;
+
+    ResultCache(std::filesystem::path dir, uint64_t maxBytes, std::chrono::hours maxAge) :
+        dir(std::move(dir)), maxBytes(maxBytes), maxAge(maxAge) {
+        std::error_code ec;
+        std::filesystem::create_directories(this->dir, ec);
+    }
+
+    std::optional<std::vector<InspectorResult>> lookup(const std::string& key) {
+        auto path = entryPath(key);
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            return std::nullopt;
+
+        json entry = json::from_cbor(in, true, false);
+        if (entry.is_discarded() || entry.value("version", 0) != FormatVersion)
+            return std::nullopt;
+
+        try {
+            for (const auto& dep : entry.at("deps")) {
+                std::filesystem::path depPath = dep.at("path").get<std::string>();
+                std::error_code ec;
+                auto size = std::filesystem::file_size(depPath, ec);
+                if (ec || size != dep.at("size").get<uintmax_t>() ||
+                    hashFile(depPath) != dep.at("hash").get<uint64_t>()) {
+                    return std::nullopt;
                 }
             }
-            result.definition = defInfo;
-            return; // Found definition
+            auto results = entry.at("results").get<std::vector<InspectorResult>>();
+
+            // Refresh the entry's age for LRU eviction.
+            std::error_code ec;
+            std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(),
+                                             ec);
+            return results;
+        }
+        catch (const json::exception&) {
+            return std::nullopt; // stale or corrupt entry; it will be overwritten
+        }
+    }
+
+    void store(const std::string& key, const std::vector<SourceStamp>& deps,
+               const std::vector<InspectorResult>& results) {
+        json entry = {{"version", FormatVersion}, {"deps", json::array()}, {"results", results}};
+        for (const auto& dep : deps) {
+            entry["deps"].push_back(
+                {{"path", dep.path.string()}, {"size", dep.size}, {"hash", dep.hash}});
+        }
+
+        // Write-then-rename so concurrent runs never read a partial entry.
+        auto path = entryPath(key);
+        auto tmpPath = path;
+        tmpPath += ".tmp" + std::to_string(::getpid());
+        {
+            std::ofstream out(tmpPath, std::ios::binary);
+            json::to_cbor(entry, out);
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, path, ec);
+        if (ec)
+            std::filesystem::remove(tmpPath, ec);
+
+        evict();
+    }
+
+private:
+    std::filesystem::path dir;
+    uint64_t maxBytes;
+    std::chrono::hours maxAge;
+
+    std::filesystem::path entryPath(const std::string& key) const { return dir / (key + ".cbor"); }
+
+    void evict() {
+        struct Entry {
+            std::filesystem::path path;
+            std::filesystem::file_time_type mtime;
+            uintmax_t size;
+        };
+
+        std::error_code ec;
+        auto now = std::filesystem::file_time_type::clock::now();
+        std::vector<Entry> entries;
+        uintmax_t total = 0;
+        for (const auto& file : std::filesystem::directory_iterator(dir, ec)) {
+            if (file.path().extension() != ".cbor")
+                continue;
+            auto mtime = file.last_write_time(ec);
+            if (now - mtime > maxAge) {
+                std::filesystem::remove(file.path(), ec);
+                continue;
+            }
+            entries.push_back({file.path(), mtime, file.file_size(ec)});
+            total += entries.back().size;
+        }
+
+        std::sort(entries.begin(), entries.end(),
+                  [](const Entry& a, const Entry& b) { return a.mtime < b.mtime; });
+        for (const auto& entry : entries) {
+            if (total <= maxBytes)
+                break;
+            std::filesystem::remove(entry.path, ec);
+            total -= entry.size;
+        }
+    }
+};
+
+// Arguments that only affect how or where results are written (or how fast they are computed),
+// and so are left out of cache keys: options taking a value, and flags.
+bool isOutputOnlyOption(std::string_view arg) {
+    static const std::set<std::string_view> options = {
+        "--json",          "--out",     "--format", "--cache-dir", "--cache-max-size",
+        "--cache-max-age", "--threads", "-j",       "--stats"};
+    return options.contains(arg.substr(0, arg.find('=')));
+}
+
+bool isOutputOnlyFlag(std::string_view arg) {
+    static const std::set<std::string_view> flags = {"--compact", "--report-rss",
+                                                      "--liberty-index-beside"};
+    // -j<N>, the joined form of -j <N>, carries its value in the same argument.
+    if (arg.size() > 2 && arg.starts_with("-j") &&
+        arg.find_first_not_of("0123456789", 2) == std::string_view::npos)
+        return true;
+    return flags.contains(arg);
+}
+
+// An existing file or directory as its absolute path; anything else unchanged.
+std::string absoluteIfPath(std::string_view arg) {
+    std::error_code ec;
+    std::filesystem::path path(arg);
+    if (arg.empty() || !std::filesystem::exists(path, ec))
+        return std::string(arg);
+    return std::filesystem::absolute(path, ec).lexically_normal().string();
+}
+
+// The form of an argument that goes into a cache key. Paths (sources, filelists, include dirs,
+// libraries, also as --opt=<path> or +incdir+<path>+...) are made absolute, so the same relative
+// argument run from another directory gets its own key.
+std::string keyArgument(std::string_view arg) {
+    if (arg.starts_with('+')) {
+        std::string key;
+        size_t start = 1;
+        while (start <= arg.size()) {
+            size_t end = std::min(arg.find('+', start), arg.size());
+            key += '+' + absoluteIfPath(arg.substr(start, end - start));
+            start = end + 1;
         }
+        return key;
     }
+    if (size_t eq = arg.find('='); arg.starts_with('-') && eq != std::string_view::npos)
+        return std::string(arg.substr(0, eq + 1)) + absoluteIfPath(arg.substr(eq + 1));
+    return absoluteIfPath(arg);
+}
+
+std::string computeCacheKey(const std::vector<const char*>& args,
+                            const std::vector<std::string>& queryNames) {
+    uint64_t hash = hashBytes("inspector-cache-v" + std::to_string(ResultCache::FormatVersion));
+    auto add = [&](std::string_view bytes) {
+        hash = hashBytes(bytes, hash);
+        hash = hashBytes(std::string_view("\0", 1), hash);
+    };
+
+    for (size_t i = 1; i < args.size(); i++) {
+        std::string_view arg = args[i];
+        if (isOutputOnlyFlag(arg))
+            continue;
+        if (isOutputOnlyOption(arg)) {
+            if (arg.find('=') == std::string_view::npos)
+                i++; // skip the option's value
+            continue;
+        }
+        add(keyArgument(arg));
+
+        // Paths listed in a -f filelist are relative to the working directory (-F: to the
+        // filelist itself, which is already absolute here).
+        if (arg == "-f") {
+            std::error_code ec;
+            add(std::filesystem::current_path(ec).string());
+        }
+    }
+    for (const auto& query : queryNames)
+        add(query);
+
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+    return key;
+}
+
+// Everything a cached result depends on: loaded sources and includes, -f filelists and
+// --liberty libraries.
+std::vector<SourceStamp> cacheDependencies(const std::vector<const char*>& args,
+                                           const SourceManager& sourceManager,
+                                           const std::vector<std::string>& libertyFiles) {
+    auto deps = stampInputs(args, sourceManager);
+    for (const auto& path : libertyFiles)
+        deps.push_back(stampFile(path));
+    return deps;
 }
 
 // ==========================================
-// Recursive AST Visitor for Instantiations
+// Replace Mode (--replace)
 // ==========================================
-void collectInstantiationsInAST(const Scope& scope, const std::string& targetName,
-                                InspectorResult& result, std::set<std::string>& visited) {
-    for (auto& member : scope.members()) {
-        if (member.kind == SymbolKind::Instance) {
-            const auto& instance = member.as<InstanceSymbol>();
-            std::string hierPath = instance.getHierarchicalPath();
-
-            if (visited.count(hierPath))
-                continue;
-            visited.insert(hierPath);
-
-            // Check if definition matches target
-            if (instance.getDefinition().name == targetName) {
-                InstanceInfo instInfo;
-                instInfo.instanceName = std::string(instance.name);
-                instInfo.fullPath = hierPath;
-                instInfo.definitionName = targetName;
-
-                for (auto conn : instance.getPortConnections()) {
-                    ConnectionInfo connInfo;
-                    connInfo.portName = std::string(conn->port.name);
-
-                    std::string dirStr = "Unknown";
-                    if (conn->port.kind == SymbolKind::Port) {
-                        dirStr = directionToString(conn->port.as<PortSymbol>().direction);
-                    }
-                    else if (conn->port.kind == SymbolKind::MultiPort) {
-                        dirStr = directionToString(conn->port.as<MultiPortSymbol>().direction);
-                    }
 
-                    const Expression* expr = conn->getExpression();
-                    if (expr) {
-                        const Type& type = *expr->type;
-                        connInfo.signalType = type.toString();
-                        connInfo.width = std::to_string(type.getBitWidth());
-                        connInfo.direction = dirStr;
-                        connInfo.isConnected = true;
-                    }
-                    else {
-                        connInfo.signalType = "Unknown";
-                        connInfo.width = "0"; // Or unknown
-                        connInfo.direction = dirStr;
-                        connInfo.isConnected = false;
+struct ReplaceSpec {
+    std::string oldMacro;
+    std::string newMacro;
+    std::unordered_map<std::string, std::string> portMap;
+};
+
+// A byte range of a source buffer and the text that replaces it.
+struct TextEdit {
+    size_t start = 0;
+    size_t end = 0;
+    std::string_view text;
+};
+
+// Records token-level edits for every instantiation of the old macro: the module type name, and
+// the name of each renamed named-port connection. Parameters, comments and formatting are left
+// untouched, and every instance in every module is handled in the same pass. Connections that do
+// not name their port (positional, or .* with renamed ports) cannot be carried over by renaming
+// tokens; they are counted so the caller can refuse the rewrite.
+class MacroRewriteVisitor : public SyntaxVisitor<MacroRewriteVisitor> {
+public:
+    MacroRewriteVisitor(const SourceManager& sourceManager, const ReplaceSpec& spec) :
+        sourceManager(sourceManager), spec(spec) {}
+
+    // Edits per source buffer ID, and the edited buffers in the order they were first edited.
+    std::unordered_map<uint32_t, std::vector<TextEdit>> edits;
+    std::vector<BufferID> editedBuffers;
+    size_t instantiations = 0;
+    size_t skippedInMacros = 0;
+    size_t unnamedConnections = 0;
+
+    void handle(const HierarchyInstantiationSyntax& syntax) {
+        if (syntax.type.valueText() == spec.oldMacro) {
+            instantiations++;
+            addEdit(syntax.type, spec.newMacro);
+            for (auto instance : syntax.instances) {
+                for (auto conn : instance->connections) {
+                    if (conn->kind == SyntaxKind::OrderedPortConnection ||
+                        (conn->kind == SyntaxKind::WildcardPortConnection &&
+                         !spec.portMap.empty())) {
+                        unnamedConnections++;
                     }
-                    instInfo.connections.push_back(connInfo);
+                    if (conn->kind != SyntaxKind::NamedPortConnection)
+                        continue;
+                    const auto& named = conn->as<NamedPortConnectionSyntax>();
+                    auto it = spec.portMap.find(std::string(named.name.valueText()));
+                    if (it != spec.portMap.end())
+                        addEdit(named.name, it->second);
                 }
-                result.instances.push_back(instInfo);
             }
+        }
+        visitDefault(syntax);
+    }
 
-            // Recurse
-            collectInstantiationsInAST(instance.body, targetName, result, visited);
+private:
+    const SourceManager& sourceManager;
+    const ReplaceSpec& spec;
+
+    void addEdit(Token token, std::string_view text) {
+        SourceLocation loc = token.location();
+        // Tokens produced by macro expansion have no single place in a file to rewrite.
+        if (!sourceManager.isFileLoc(loc)) {
+            skippedInMacros++;
+            return;
         }
-        else if (member.kind == SymbolKind::UninstantiatedDef) {
-            const auto& uninst = member.as<UninstantiatedDefSymbol>();
-            std::string hierPath = uninst.getHierarchicalPath();
+        size_t start = loc.offset();
+        auto& bufferEdits = edits[loc.buffer().getId()];
+        if (bufferEdits.empty())
+            editedBuffers.push_back(loc.buffer());
+        bufferEdits.push_back({start, start + token.rawText().size(), text});
+    }
+};
 
-            if (visited.count(hierPath))
-                continue;
-            visited.insert(hierPath);
+// Streams a source buffer to disk with the edits applied, straight from the SourceManager's
+// copy of the text: unchanged regions are written as slices, never copied into a new string.
+bool writeEditedBuffer(std::string_view text, std::vector<TextEdit>& edits,
+                       const std::filesystem::path& outPath) {
+    // The lexer's null terminator is not part of the file.
+    if (!text.empty() && text.back() == '\0')
+        text.remove_suffix(1);
+
+    std::sort(edits.begin(), edits.end(),
+              [](const TextEdit& a, const TextEdit& b) { return a.start < b.start; });
+
+    std::ofstream out(outPath, std::ios::binary);
+    if (!out) {
+        std::cerr << "Error: cannot write " << outPath.string() << '\n';
+        return false;
+    }
 
-            if (uninst.definitionName == targetName) {
-                InstanceInfo instInfo;
-                instInfo.instanceName = std::string(uninst.name);
-                instInfo.fullPath = hierPath;
-                instInfo.definitionName = targetName;
+    size_t pos = 0;
+    for (const auto& edit : edits) {
+        out.write(text.data() + pos, static_cast<std::streamsize>(edit.start - pos));
+        out.write(edit.text.data(), static_cast<std::streamsize>(edit.text.size()));
+        pos = edit.end;
+    }
+    out.write(text.data() + pos, static_cast<std::streamsize>(text.size() - pos));
+    return static_cast<bool>(out);
+}
 
-                auto portNames = uninst.getPortNames();
-                auto portExprs = uninst.getPortConnections();
+// Deepest directory containing all of the given absolute file paths.
+std::filesystem::path commonDirectory(const std::vector<std::filesystem::path>& files) {
+    std::filesystem::path base = files.front().parent_path();
+    for (const auto& file : files) {
+        while (base != base.parent_path()) {
+            auto relative = file.parent_path().lexically_relative(base);
+            if (!relative.empty() && *relative.begin() != "..")
+                break;
+            base = base.parent_path();
+        }
+    }
+    return base;
+}
 
-                for (size_t i = 0; i < portExprs.size(); i++) {
-                    ConnectionInfo connInfo;
-                    if (i < portNames.size() && !portNames[i].empty()) {
-                        connInfo.portName = std::string(portNames[i]);
-                    }
-                    else {
-                        connInfo.portName = "[Positional #" + std::to_string(i) + "]";
-                    }
+// Rewrites all parsed sources. With a single source file (includes aside) `outPath` is the
+// output file; otherwise it is a directory receiving each changed file, included ones too, at its
+// path relative to the deepest directory holding all of them.
+int replaceMacros(Driver& driver, const ReplaceSpec& spec, const std::filesystem::path& outPath) {
+    const SourceManager& sourceManager = driver.sourceManager;
+    MacroRewriteVisitor visitor(sourceManager, spec);
+
+    // Files named on the command line (or in filelists), in order; `include`d files are edited
+    // along with them but do not count towards choosing file or directory output.
+    std::vector<BufferID> sources;
+    for (const auto& tree : driver.syntaxTrees) {
+        tree->root().visit(visitor);
+        for (BufferID buffer : tree->getSourceBufferIds()) {
+            if (!sourceManager.getIncludedFrom(buffer).valid())
+                sources.push_back(buffer);
+        }
+    }
 
-                    if (portExprs[i] && portExprs[i]->kind == AssertionExprKind::Simple) {
-                        const auto& simpleExpr = portExprs[i]->as<SimpleAssertionExpr>();
-                        const Expression& expr = simpleExpr.expr;
-                        const Type& type = *expr.type;
+    if (visitor.unnamedConnections > 0) {
+        std::cerr << "Error: " << visitor.unnamedConnections << " connection(s) of '"
+                  << spec.oldMacro << "' do not name their port (positional, or .* with "
+                  << "renamed ports); --replace only renames named connections." << '\n';
+        return 1;
+    }
 
-                        connInfo.signalType = type.toString();
-                        connInfo.width = inferWidth(expr, scope);
-                        connInfo.isConnected = true;
-                    }
-                    else if (portExprs[i]) {
-                        // Some other connection type, considered connected but maybe complex
-                        connInfo.signalType = "Complex/Unresolved"; // Simplified for now
-                        connInfo.width = "0";
-                        connInfo.isConnected = true;
-                    }
-                    else {
-                        connInfo.signalType = "Unconnected";
-                        connInfo.width = "0";
-                        connInfo.isConnected = false;
-                    }
+    const auto& edited = visitor.editedBuffers;
+    bool singleFile = sources.size() == 1;
+    if (singleFile && !edited.empty() && (edited.size() > 1 || edited[0] != sources[0])) {
+        std::cerr << "Error: instantiations of '" << spec.oldMacro
+                  << "' are in included files; pass a directory as --out." << '\n';
+        return 1;
+    }
 
-                    connInfo.direction = "Unknown";
-                    // Try to look up direction from definition if available
-                    if (result.definition) {
-                        for (const auto& p : result.definition->ports) {
-                            if (p.name == connInfo.portName) {
-                                connInfo.direction = p.direction;
-                                break;
-                            }
-                        }
-                    }
+    std::vector<std::filesystem::path> paths;
+    for (BufferID buffer : edited)
+        paths.push_back(sourceManager.getFullPath(buffer));
+    std::filesystem::path base = paths.empty() ? std::filesystem::path() : commonDirectory(paths);
+
+    size_t filesWritten = 0;
+    for (size_t i = 0; i < edited.size(); i++) {
+        std::filesystem::path target = outPath;
+        if (!singleFile) {
+            target /= paths[i].lexically_relative(base);
+            std::filesystem::create_directories(target.parent_path());
+        }
+        auto& edits = visitor.edits[edited[i].getId()];
+        if (!writeEditedBuffer(sourceManager.getSourceText(edited[i]), edits, target))
+            return 1;
+        filesWritten++;
+    }
 
-                    instInfo.connections.push_back(connInfo);
-                }
-                result.instances.push_back(instInfo);
-            }
+    if (visitor.skippedInMacros > 0) {
+        std::cerr << "Warning: " << visitor.skippedInMacros
+                  << " token(s) inside macro expansions were not rewritten." << '\n';
+    }
+    std::cout << "Replaced " << visitor.instantiations << " instantiation(s) of '"
+              << spec.oldMacro << "' with '" << spec.newMacro << "' in " << filesWritten
+              << " file(s)." << '\n';
+    return visitor.instantiations > 0 ? 0 : 1;
+}
+
+// Builds the replace spec from --old-macro/--new-macro, --port-map and --port.
+std::optional<ReplaceSpec> buildReplaceSpec(const InspectorOptions& opts) {
+    if (!opts.oldMacro || !opts.newMacro || !opts.outPath) {
+        std::cerr << "Error: --replace requires --old-macro, --new-macro and --out." << '\n';
+        return std::nullopt;
+    }
+
+    ReplaceSpec spec;
+    spec.oldMacro = *opts.oldMacro;
+    spec.newMacro = *opts.newMacro;
+
+    if (opts.portMapFile) {
+        std::ifstream in(*opts.portMapFile);
+        json doc = json::parse(in, nullptr, false);
+        if (!doc.is_object()) {
+            std::cerr << "Error: port map '" << *opts.portMapFile
+                      << "' must be a JSON object of old -> new port names" << '\n';
+            return std::nullopt;
+        }
+        for (const auto& [oldPort, newPort] : doc.items()) {
+            if (newPort.is_string())
+                spec.portMap[oldPort] = newPort.get<std::string>();
         }
-        else if (member.isScope()) {
-            collectInstantiationsInAST(member.as<Scope>(), targetName, result, visited);
+    }
+
+    for (const auto& rename : opts.portRenames) {
+        size_t eq = rename.find('=');
+        if (eq == std::string::npos || eq == 0 || eq + 1 == rename.size()) {
+            std::cerr << "Error: --port expects <old>=<new>, got '" << rename << "'" << '\n';
+            return std::nullopt;
         }
+        spec.portMap[rename.substr(0, eq)] = rename.substr(eq + 1);
     }
+    return spec;
 }
 
 // ==========================================
-// Print Helper
+// Server Mode (--serve)
 // ==========================================
-void printTextOutput(const InspectorResult& result) {
-    if (result.definition) {
-        const auto& def = *result.definition;
-        std::cout << "[Result] Found Definition for '" << def.name << "'" << '\n';
-        std::cout << "--------------------------------------------" << '\n';
-        std::cout << "Source: Full Module Definition (AST)" << '\n';
-        for (const auto& port : def.ports) {
-            std::cout << "  Port: " << port.name << " | Dir: " << port.direction
-                      << " | Type: " << port.type << '\n';
+
+// Line-delimited JSON-RPC 2.0. Methods:
+//   inspect     {"module": name} -> InspectorResult, or {"queries": [...]} -> results keyed by query
+//   definition  {"module": name} -> DefinitionInfo or null
+//   instances   {"module": name} -> [InstanceInfo]
+//   reload      {}               -> true (re-elaborates unconditionally)
+//   shutdown    {}               -> true
+// Before each request the sources are checked and the design is re-elaborated only if one of
+// them actually changed.
+class InspectorServer {
+public:
+    InspectorServer(std::vector<const char*> args, LoadedDesign loaded,
+                    CollectOptions collect = {}) :
+        args(std::move(args)), design(std::move(loaded)), collect(collect) {
+        design.sources = stampInputs(this->args, design.driver->sourceManager);
+    }
+
+    bool isShutdown() const { return shutdown; }
+
+    // Handles one request line; returns the response line, or an empty string for notifications.
+    std::string handleLine(const std::string& line) {
+        json request = json::parse(line, nullptr, false);
+        if (request.is_discarded() || !request.is_object())
+            return makeError(nullptr, -32700, "Parse error").dump();
+
+        json id = request.value("id", json());
+        if (!request.contains("method") || !request["method"].is_string())
+            return makeError(id, -32600, "Invalid Request").dump();
+
+        json response;
+        try {
+            response = dispatch(request["method"].get<std::string>(),
+                                request.value("params", json::object()), id);
         }
-        std::cout << "--------------------------------------------" << '\n';
+        catch (const std::exception& e) {
+            response = makeError(id, -32603, e.what());
+        }
+
+        if (!request.contains("id"))
+            return {};
+        return response.dump();
     }
 
-    if (!result.instances.empty()) {
-        for (const auto& inst : result.instances) {
-            std::cout << "[Result] Found Instantiation (AST) for '" << inst.definitionName << "'"
-                      << '\n';
-            std::cout << "  Instance Name: " << inst.instanceName << '\n';
-            std::cout << "  Full Path: " << inst.fullPath << '\n';
-            std::cout << "--------------------------------------------" << '\n';
-            std::cout << "Source: AST Connection Analysis" << '\n';
+private:
+    std::vector<const char*> args;
+    LoadedDesign design;
+    CollectOptions collect;
+    bool shutdown = false;
 
-            for (const auto& conn : inst.connections) {
-                std::cout << "  Port: " << conn.portName << " | Dir: " << conn.direction;
-                if (conn.isConnected) {
-                    std::cout << " | Connected Signal Type: " << conn.signalType
-                              << " | Width: " << conn.width;
-                }
-                else {
-                    std::cout << " | Unconnected";
+    static json makeError(const json& id, int code, const std::string& message) {
+        return {{"jsonrpc", "2.0"}, {"id", id}, {"error", {{"code", code}, {"message", message}}}};
+    }
+
+    static json makeResult(const json& id, json result) {
+        return {{"jsonrpc", "2.0"}, {"id", id}, {"result", std::move(result)}};
+    }
+
+    bool reload() {
+        InspectorOptions scratch;
+        auto driver = createDriver(scratch);
+        if (!driver->parseCommandLine(static_cast<int>(args.size()), args.data()))
+            return false;
+
+        LoadedDesign fresh;
+        if (!elaborateDesign(std::move(driver), fresh))
+            return false;
+        fresh.sources = stampInputs(args, fresh.driver->sourceManager);
+        // Drop the old compilation before the driver that owns its sources.
+        design.compilation.reset();
+        design = std::move(fresh);
+        return true;
+    }
+
+    json dispatch(const std::string& method, const json& params, const json& id) {
+        if (method == "shutdown") {
+            shutdown = true;
+            return makeResult(id, true);
+        }
+
+        if (method == "reload" || sourcesChanged(design.sources)) {
+            std::cerr << "[serve] Sources changed, re-elaborating." << '\n';
+            if (!reload())
+                return makeError(id, -32000, "Failed to reload design");
+            if (method == "reload")
+                return makeResult(id, true);
+        }
+
+        if (method == "inspect" && params.contains("queries")) {
+            const json& queries = params["queries"];
+            bool valid = queries.is_array();
+            for (const auto& q : valid ? queries : json::array())
+                valid &= q.is_string();
+            if (!valid)
+                return makeError(id, -32602, "Parameter 'queries' must be an array of strings");
+            auto names = queries.get<std::vector<std::string>>();
+            auto results = runQueries(*design.compilation, names, nullptr, collect);
+            json out = json::object();
+            for (size_t i = 0; i < results.size(); i++)
+                out[names[i]] = results[i];
+            return makeResult(id, std::move(out));
+        }
+
+        if (method != "inspect" && method != "definition" && method != "instances")
+            return makeError(id, -32601, "Method not found");
+
+        if (!params.contains("module") || !params["module"].is_string())
+            return makeError(id, -32602, "Missing string parameter 'module'");
+
+        // A definition request has no use for the instance walk.
+        CollectOptions options = collect;
+        options.instances = method != "definition";
+        auto results = runQueries(*design.compilation, {params["module"].get<std::string>()},
+                                  nullptr, options);
+        const InspectorResult& result = results[0];
+        if (method == "definition")
+            return makeResult(id, result.definition ? json(*result.definition) : json());
+        if (method == "instances")
+            return makeResult(id, result.instances);
+        return makeResult(id, result);
+    }
+};
+
+int serveStdio(InspectorServer& server) {
+    std::string line;
+    while (!server.isShutdown() && std::getline(std::cin, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+        std::string response = server.handleLine(line);
+        if (!response.empty())
+            std::cout << response << '\n' << std::flush;
+    }
+    return 0;
+}
+
+bool writeAll(int fd, std::string_view data) {
+    while (!data.empty()) {
+        ssize_t n = ::write(fd, data.data(), data.size());
+        if (n <= 0)
+            return false;
+        data.remove_prefix(static_cast<size_t>(n));
+    }
+    return true;
+}
+
+// Accepts one client at a time; the Compilation is not safe to query concurrently.
+int serveSocket(InspectorServer& server, const std::string& path) {
+    // A client that disconnects before reading its reply must not kill the server; the write
+    // fails with EPIPE instead and the next client is accepted.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    int listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        std::cerr << "Error: could not create socket." << '\n';
+        return 1;
+    }
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Error: socket path too long: " << path << '\n';
+        ::close(listenFd);
+        return 1;
+    }
+    std::copy(path.begin(), path.end(), addr.sun_path);
+    ::unlink(path.c_str());
+
+    if (::bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        ::listen(listenFd, 4) < 0) {
+        std::cerr << "Error: could not listen on " << path << '\n';
+        ::close(listenFd);
+        return 1;
+    }
+    std::cerr << "[serve] Listening on " << path << '\n';
+
+    while (!server.isShutdown()) {
+        int clientFd = ::accept(listenFd, nullptr, nullptr);
+        if (clientFd < 0)
+            continue;
+
+        std::string pending;
+        char buffer[1 << 16];
+        ssize_t n;
+        bool connected = true;
+        while (connected && !server.isShutdown() &&
+               (n = ::read(clientFd, buffer, sizeof(buffer))) > 0) {
+            pending.append(buffer, static_cast<size_t>(n));
+            size_t start = 0, newline;
+            while ((newline = pending.find('\n', start)) != std::string::npos) {
+                std::string line = pending.substr(start, newline - start);
+                start = newline + 1;
+                if (line.find_first_not_of(" \t\r") == std::string::npos)
+                    continue;
+                std::string response = server.handleLine(line);
+                if (!response.empty() && !writeAll(clientFd, response + '\n')) {
+                    connected = false;
+                    break;
                 }
-                std::cout << '\n';
             }
-            std::cout << "--------------------------------------------" << '\n';
+            pending.erase(0, start);
         }
+        ::close(clientFd);
     }
-    else if (!result.definition) {
-        // Only print if neither was found? The original code printed "AST search yielded no
-        // results." if foundInstances was false. But foundInAST (definition) returned earlier. We
-        // will handle "Not found" in main.
+
+    ::close(listenFd);
+    ::unlink(path.c_str());
+    return 0;
+}
+
+// ==========================================
+// Main
+// ==========================================
+
+// Prints the peak RSS when main() returns, whichever mode ran.
+struct PeakRssReporter {
+    const std::optional<bool>& enabled;
+    ~PeakRssReporter() {
+        if (enabled == true)
+            std::cerr << "Peak RSS: " << (peakRssBytes() >> 20) << " MiB" << '\n';
     }
+};
+
+// Writes the --stats report when main() returns: to the file of --stats <file>, or to stderr
+// for --stats - or a --stats without a file so it never mixes with results on stdout.
+struct StatsReporter {
+    const std::optional<std::string>& path;
+    const bool& toStderr;
+    RunStats& stats;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    ~StatsReporter() {
+        if (!path && !toStderr)
+            return;
+        std::chrono::duration<double> total = std::chrono::steady_clock::now() - start;
+        stats.add("total", total.count(), processCpuSeconds());
+        std::string report = stats.toJson().dump(4);
+        if (path) {
+            std::ofstream out(*path);
+            out << report << std::endl;
+        }
+        else {
+            std::cerr << report << std::endl;
+        }
+    }
+};
+
+// Arguments that are neither options (-x / --x) nor plusargs (+incdir+...).
+bool isBareArgument(const char* arg) {
+    return arg[0] != '-' && arg[0] != '+';
+}
+
+// Whether argv names the module of the legacy form `inspector <verilog_file> <module_name>`.
+// Only a plain identifier that does not exist as a file qualifies, and only without --query,
+// --module or --top; a mistyped second source (`b_typo.v`, `rtl/b.sv`) stays a source, so slang
+// reports it as missing.
+bool isLegacyModuleName(std::span<const char* const> args) {
+    if (args.size() < 3 || !isBareArgument(args[1]) || !isBareArgument(args[2]))
+        return false;
+    for (std::string_view arg : args.subspan(3)) {
+        for (std::string_view option : {"--query", "--module", "--top"}) {
+            if (arg.starts_with(option))
+                return false;
+        }
+    }
+
+    std::string_view name = args[2];
+    auto isIdentifierChar = [](char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$';
+    };
+    if (!std::isalpha(static_cast<unsigned char>(name[0])) && name[0] != '_')
+        return false;
+    return std::all_of(name.begin(), name.end(), isIdentifierChar) &&
+           !std::filesystem::exists(name);
 }
 
 int main(int argc, char** argv) {
-    if (argc < 3) {
+    InspectorOptions opts;
+    PeakRssReporter rssReporter{opts.reportRss};
+    RunStats runStats;
+    bool statsToStderr = false;
+    StatsReporter statsReporter{opts.statsFile, statsToStderr, runStats};
+    auto driver = createDriver(opts);
+
+    // Legacy form: inspector <verilog_file> <module_name> [--json <output_file>]
+    // The module name is not a source file, so pull it out before slang sees the positionals.
+    std::vector<const char*> args(argv, argv + argc);
+    std::optional<std::string> legacyModule;
+    if (isLegacyModuleName(args)) {
+        legacyModule = argv[2];
+        args.erase(args.begin() + 2);
+    }
+
+    // --stats with no file (last, or followed by another option) or with "-" reports to stderr.
+    // Those forms are taken out here, as slang's parser would use the next argument as the file;
+    // --stats <file> and --stats=<file> are left to it.
+    for (size_t i = 1; i < args.size();) {
+        std::string_view arg = args[i];
+        size_t count = 0;
+        if (arg == "--stats=-")
+            count = 1;
+        else if (arg == "--stats" && i + 1 < args.size() && std::string_view(args[i + 1]) == "-")
+            count = 2;
+        else if (arg == "--stats" && (i + 1 == args.size() || !isBareArgument(args[i + 1])))
+            count = 1;
+
+        if (count == 0) {
+            i++;
+            continue;
+        }
+        statsToStderr = true;
+        args.erase(args.begin() + i, args.begin() + i + count);
+    }
+
+    if (!driver->parseCommandLine(static_cast<int>(args.size()), args.data()))
+        return 1;
+
+    if (opts.showHelp == true) {
+        std::cout << driver->cmdLine.getHelpText("SlangPortInspector: module port inspector");
+        return 0;
+    }
+
+    std::vector<std::string>& queryNames = opts.queryNames;
+    if (opts.queryFile) {
+        std::ifstream in(*opts.queryFile);
+        json doc = json::parse(in, nullptr, false);
+        if (doc.is_object() && doc.contains("queries"))
+            doc = doc["queries"];
+        bool valid = doc.is_array();
+        for (const auto& q : valid ? doc : json::array())
+            valid &= q.is_string();
+        if (!valid) {
+            std::cerr << "Error: query file '" << *opts.queryFile
+                      << "' must contain an array of names" << '\n';
+            return 1;
+        }
+        for (const auto& q : doc)
+            queryNames.push_back(q.get<std::string>());
+    }
+
+    // Without --query/--query-file the single target module is answered as before and the
+    // output keeps its original (unkeyed) shape. Otherwise --module is just one more query.
+    bool multiQuery = !queryNames.empty();
+    std::string targetModuleName = opts.targetModule.value_or(legacyModule.value_or(""));
+    if (!targetModuleName.empty())
+        queryNames.push_back(targetModuleName);
+
+    if (opts.replace == true) {
+        auto spec = buildReplaceSpec(opts);
+        if (!spec || !parseSources(*driver))
+            return 1;
+        return replaceMacros(*driver, *spec, *opts.outPath);
+    }
+
+    if (queryNames.empty() && opts.serve != true) {
         std::cerr << "Usage: " << argv[0] << " <verilog_file> <module_name> [--json <output_file>]"
+                  << '\n'
+                  << "       " << argv[0]
+                  << " [<files>...] [-f <filelist>] [+incdir+<dir>] [+define+<macro>]"
+                     " [--threads <N>] [--top <module>] [--scope <hier.path>] --module <name>"
+                     " [--json <output_file>]"
+                  << '\n'
+                  << "       " << argv[0]
+                  << " [<files>...] --query <name|glob>... | --query-file <file>"
+                     " [--json <output_file>]"
+                  << '\n'
+                  << "       " << argv[0] << " [<files>...] --serve [--socket <path>]" << '\n'
+                  << "       " << argv[0]
+                  << " [<files>...] --replace --old-macro <name> --new-macro <name>"
+                     " [--port <old>=<new>]... [--port-map <file>] --out <path>"
                   << '\n';
         return 1;
     }
 
-    std::string verilogFile = argv[1];
-    std::string targetModuleName = argv[2];
-    std::string jsonOutputFile;
-    bool jsonOutput = false;
-
-    // Simple arg parsing
-    for (int i = 3; i < argc; i++) {
-        std::string arg = argv[i];
-        if (arg == "--json" && i + 1 < argc) {
-            jsonOutput = true;
-            jsonOutputFile = argv[++i];
+    RunStats* stats = opts.statsFile || statsToStderr ? &runStats : nullptr;
+
+    LibertyDatabase liberty;
+    if (!opts.libertyFiles.empty()) {
+        RunStats::Phase phase(stats, "liberty");
+        std::string error;
+        std::optional<std::string> indexDir;
+        if (opts.libertyIndexBeside != true)
+            indexDir = opts.cacheDir.value_or(defaultCacheDir());
+        if (!liberty.load(opts.libertyFiles, indexDir, error)) {
+            std::cerr << "Error: " << error << '\n';
+            return 1;
+        }
+        if (stats) {
+            stats->count("libertyCells", liberty.cellCount());
+            stats->count("libertyIndexesBuilt", liberty.indexesBuilt());
         }
     }
+    const LibertyDatabase* libertyDb = liberty.empty() ? nullptr : &liberty;
 
-    SourceManager sourceManager;
+    if (opts.serve == true) {
+        LoadedDesign design;
+        if (!elaborateDesign(std::move(driver), design) ||
+            !validScope(*design.compilation, opts.scope))
+            return 1;
+        CollectOptions collect;
+        collect.liberty = libertyDb;
+        collect.scope = opts.scope.value_or("");
+        InspectorServer server(args, std::move(design), collect);
+        return opts.socketPath ? serveSocket(server, *opts.socketPath) : serveStdio(server);
+    }
+
+    // --json <file> is shorthand for --format json --out <file>.
+    std::string format = opts.format.value_or(opts.jsonOutputFile ? "json" : "text");
+    std::string outPath = opts.outPath.value_or(opts.jsonOutputFile.value_or("-"));
+    if (format != "text" && format != "json" && format != "ndjson" && format != "cbor" &&
+        format != "msgpack") {
+        std::cerr << "Error: unknown --format '" << format << "'" << '\n';
+        return 1;
+    }
+    bool compact = opts.compact == true;
+    if (compact && (format == "text" || format == "ndjson")) {
+        std::cerr << "Error: --compact requires --format json, cbor or msgpack" << '\n';
+        return 1;
+    }
 
-    auto treeResult = SyntaxTree::fromFile(verilogFile, sourceManager);
-    if (!treeResult) {
-        std::cerr << "Error loading file." << '\n';
+    auto fields = opts.fields ? FieldSet::parse(*opts.fields) : FieldSet::all();
+    if (!fields) {
+        std::cerr << "Error: unknown field in --fields '" << *opts.fields << "'" << '\n';
+        return 1;
+    }
+    if (opts.scope && opts.syntaxOnly == true) {
+        std::cerr << "Error: --scope requires elaboration and cannot be used with --syntax-only"
+                  << '\n';
         return 1;
     }
-    const std::shared_ptr<SyntaxTree>& tree = *treeResult;
+    if (opts.fields && opts.syntaxOnly == true) {
+        std::cerr << "Error: --fields applies to elaborated queries and cannot be used with "
+                     "--syntax-only"
+                  << '\n';
+        return 1;
+    }
+
+    // With --stats, result bytes are counted on their way to the output.
+    std::ofstream outFile;
+    std::optional<CountingStreamBuf> countingBuf;
+    std::optional<std::ostream> countedOut;
+    auto openResults = [&]() -> std::ostream& {
+        std::ostream& out = openOutput(outPath, outFile);
+        if (!stats)
+            return out;
+        countingBuf.emplace(out.rdbuf(), stats->counter("bytesSerialized"));
+        countedOut.emplace(&*countingBuf);
+        return *countedOut;
+    };
+
+    std::optional<ResultCache> cache;
+    std::string cacheKey;
+    std::optional<std::vector<InspectorResult>> cached;
+    if (opts.cacheDir) {
+        RunStats::Phase phase(stats, "cacheLookup");
+        cache.emplace(*opts.cacheDir, uint64_t(opts.cacheMaxSizeMb.value_or(1024)) << 20,
+                      std::chrono::hours(24) * opts.cacheMaxAgeDays.value_or(30));
+        cacheKey = computeCacheKey(args, queryNames);
+        cached = cache->lookup(cacheKey);
+    }
+
+    LoadedDesign design;
+    std::vector<InspectorResult> results;
+    if (cached) {
+        results = std::move(*cached);
+    }
+    else if (opts.syntaxOnly == true) {
+        {
+            RunStats::Phase phase(stats, "parse");
+            if (!parseSources(*driver))
+                return 1;
+        }
+        if (stats) {
+            stats->count("syntaxTrees", driver->syntaxTrees.size());
+            for (const auto& tree : driver->syntaxTrees)
+                stats->countDiagnostics(tree->diagnostics());
+        }
+
+        // As for elaborated collection, only an explicit --threads N (N != 1) scans files in
+        // parallel, with 0 meaning one worker per hardware thread.
+        RunStats::Phase phase(stats, "collectInstances");
+        unsigned threads = driver->options.numThreads.value_or(1);
+        results = collectFromSyntax(driver->syntaxTrees, queryNames,
+                                    threads ? threads : std::thread::hardware_concurrency(),
+                                    libertyDb);
+        if (opts.definitionsOnly == true) {
+            for (auto& result : results)
+                result.instances.clear();
+        }
+        if (cache)
+            cache->store(cacheKey,
+                         cacheDependencies(args, driver->sourceManager, opts.libertyFiles),
+                         results);
+    }
+    else {
+        if (!elaborateDesign(std::move(driver), design, stats) ||
+            !validScope(*design.compilation, opts.scope))
+            return 1;
 
-    CompilationOptions options;
-    Compilation compilation(options);
-    compilation.addSyntaxTree(tree);
+        // An explicit --threads N (N != 1) also parallelises collection over the elaborated
+        // hierarchy; 0 means one worker per hardware thread, as for parsing. Preparing for it
+        // elaborates the whole design, so a --scope walk stays serial and --definitions-only,
+        // which has no walk, skips it.
+        CollectOptions collect{1, *fields, stats, libertyDb, opts.scope.value_or("")};
+        collect.instances = opts.definitionsOnly != true;
+        if (auto numThreads = design.driver->options.numThreads;
+            numThreads && *numThreads != 1 && !opts.scope && collect.instances) {
+            collect.threads = *numThreads ? *numThreads : std::thread::hardware_concurrency();
+            prepareParallelCollection(*design.compilation);
+        }
 
-    InspectorResult result;
+        if (format == "ndjson" && !cache) {
+            // Nothing is accumulated: every instance is written as soon as it is collected.
+            // (The parallel collector buffers per subtree and streams after merging.)
+            NdjsonWriter writer(openResults(), multiQuery ? &queryNames : nullptr);
+            runQueries(*design.compilation, queryNames, &writer, collect);
+            if (stats) {
+                stats->count("instancesReported", writer.instanceCount());
+                stats->count("connectionsReported", writer.connectionCount());
+                if (!opts.scope)
+                    countCompilationDiagnostics(*stats, *design.compilation);
+            }
+            return writer.count() > 0 ? 0 : 1;
+        }
 
-    // Collect Definition
-    collectModuleInAST(compilation, targetModuleName, result);
+        // Every query is answered from the same elaboration and a single hierarchy traversal.
+        results = runQueries(*design.compilation, queryNames, nullptr, collect);
+        // Diagnostics cover the whole design, which a --scope run never elaborates.
+        if (stats && !opts.scope)
+            countCompilationDiagnostics(*stats, *design.compilation);
+        if (cache)
+            cache->store(cacheKey,
+                         cacheDependencies(args, design.driver->sourceManager, opts.libertyFiles),
+                         results);
+    }
 
-    // Collect Instantiations
-    std::set<std::string> visited;
-    collectInstantiationsInAST(compilation.getRoot(), targetModuleName, result, visited);
+    bool foundAny = false;
+    for (const auto& result : results)
+        foundAny |= result.definition.has_value() || !result.instances.empty();
 
-    bool foundAny = result.definition.has_value() || !result.instances.empty();
+    if (stats)
+        countResults(*stats, results);
 
-    if (jsonOutput) {
-        json j = result;
-        std::ofstream o(jsonOutputFile);
-        o << j.dump(4) << std::endl;
-        // Also print text output? Usually separate.
+    RunStats::Phase serializePhase(stats, "serialize");
+    if (format == "ndjson") {
+        NdjsonWriter writer(openResults(), multiQuery ? &queryNames : nullptr);
+        for (size_t q = 0; q < results.size(); q++) {
+            if (results[q].definition)
+                writer.definition(q, *results[q].definition);
+        }
+        for (size_t q = 0; q < results.size(); q++) {
+            for (auto& info : results[q].instances)
+                writer.instance(q, std::move(info));
+        }
+    }
+    else if (format != "text") {
+        json j;
+        if (compact) {
+            j = CompactEncoder().encode(queryNames, results, multiQuery);
+        }
+        else if (multiQuery) {
+            j = json::object();
+            for (size_t i = 0; i < results.size(); i++)
+                j[queryNames[i]] = results[i];
+        }
+        else {
+            j = results[0];
+        }
+
+        // The binary encodings carry the same document as the JSON output, just smaller and
+        // cheaper to encode/decode; callers typically read them straight from a pipe.
+        std::ostream& out = openResults();
+        if (format == "cbor")
+            json::to_cbor(j, out);
+        else if (format == "msgpack")
+            json::to_msgpack(j, out);
+        else
+            out << (compact ? j.dump() : j.dump(4)) << std::endl;
+        out.flush();
     }
     else {
         if (!foundAny) {
             std::cout << "AST search yielded no results." << '\n';
             return 1;
         }
-        printTextOutput(result);
+        for (size_t i = 0; i < results.size(); i++) {
+            if (multiQuery)
+                std::cout << "[Query] " << queryNames[i] << '\n';
+            printTextOutput(results[i]);
+        }
     }
 
     // Return 0 if found anything, or if we successfully checked even if empty?
     // Original code: if definition found -> return 0. If instances found -> return 0. Else 1.
     return foundAny ? 0 : 1;
-}
\ No newline at end of file
+}
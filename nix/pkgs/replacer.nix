@@ -25,6 +25,10 @@ buildPythonApplication {
     hatchling
   ];
 
+  dependencies = [
+    cbor2
+  ];
+
   postPatch = ''
     substituteInPlace src/macro_replacer/replacer.py \
       --replace-fail 'os.path.join(os.path.dirname(os.path.abspath(__file__)), "inspector/build/inspector")' '"${slangInspector}/bin/inspector"'
@@ -32,6 +36,7 @@ buildPythonApplication {
 
   checkPhase = ''
     export INSPECTOR_PATH="${slangInspector}/bin/inspector"
+    python3 -m unittest discover -s tests/unit
     python3 tests/integration/test_runner.py
   '';
 
@@ -0,0 +1,142 @@
+"""Reader for the inspector's compact output (--compact).
+
+The compact document stores every string once in "strings", instance paths as nodes of a
+tree of [parent, segment] pairs and identical connection lists once in "connectionSets":
+
+    {
+      "format": "inspector-compact", "version": 1,
+      "multiQuery": false, "queries": ["sram_*"],
+      "strings": ["top", "u_core", ...],
+      "nodes": [[-1, 0], [0, 1], ...],
+      "connectionSets": [[[port, signalType, width, direction, isConnected], ...], ...],
+      "results": [{"definition": {...} | null,
+                   "instances": [[node, name, definition, set, start, end], ...]}]
+    }
+
+An instance's name is -1 when it equals the last segment of its path, and its node is -1
+when it has no path. CompactResults expands paths and instances on demand, so a caller
+that only needs a few instances (or only their paths) never builds the full result set;
+expand() reproduces the document the inspector writes without --compact.
+
+Usage: python -m macro_replacer.compact results.json [--out expanded.json]
+"""
+
+import argparse
+import json
+import sys
+
+FORMAT = "inspector-compact"
+VERSION = 1
+
+
+class CompactResults:
+    """Lazy view over a parsed compact document."""
+
+    def __init__(self, doc):
+        if doc.get("format") != FORMAT or doc.get("version") != VERSION:
+            raise ValueError(f"not an inspector compact document (version {VERSION})")
+        self.doc = doc
+        self.queries = doc["queries"]
+        self.strings = doc["strings"]
+        self.nodes = doc["nodes"]
+        self.connection_sets = doc["connectionSets"]
+        self._paths = {}
+
+    def path(self, node):
+        """Full hierarchical path of a node; shared prefixes are expanded once."""
+        if node < 0:
+            return ""
+        missing = []
+        while node >= 0 and node not in self._paths:
+            missing.append(node)
+            node = self.nodes[node][0]
+        prefix = self._paths.get(node, "")
+        for index in reversed(missing):
+            segment = self.strings[self.nodes[index][1]]
+            prefix = f"{prefix}.{segment}" if prefix else segment
+            self._paths[index] = prefix
+        return prefix
+
+    def connections(self, index):
+        strings = self.strings
+        return [
+            {
+                "portName": strings[port],
+                "signalType": strings[signal],
+                "width": strings[width],
+                "direction": strings[direction],
+                "isConnected": connected,
+            }
+            for port, signal, width, direction, connected in self.connection_sets[index]
+        ]
+
+    def instance(self, encoded):
+        node, name, definition, connections, start, end = encoded
+        return {
+            "instanceName": (
+                self.strings[self.nodes[node][1]] if name < 0 else self.strings[name]
+            ),
+            "fullPath": self.path(node),
+            "definitionName": self.strings[definition],
+            "connections": self.connections(connections),
+            "startOffset": start,
+            "endOffset": end,
+        }
+
+    def _result(self, query):
+        return self.doc["results"][self.queries.index(query)]
+
+    def definition(self, query):
+        return self._result(query)["definition"]
+
+    def instances(self, query):
+        """Yields the instances answering a query, expanded one at a time."""
+        for encoded in self._result(query)["instances"]:
+            yield self.instance(encoded)
+
+    def result(self, query):
+        return {
+            "definition": self.definition(query),
+            "instances": list(self.instances(query)),
+        }
+
+    def expand(self):
+        """The document the inspector writes for the same run without --compact."""
+        if not self.doc["multiQuery"]:
+            return self.result(self.queries[0])
+        return {query: self.result(query) for query in self.queries}
+
+
+def load(path):
+    with open(path, "r") as f:
+        return CompactResults(json.load(f))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Expand compact inspector output to the regular JSON shape."
+    )
+    parser.add_argument(
+        "input", help="Compact JSON written with --compact ('-' for stdin)"
+    )
+    parser.add_argument(
+        "--out", default="-", help="Expanded JSON file ('-' for stdout)"
+    )
+    args = parser.parse_args()
+
+    if args.input == "-":
+        results = CompactResults(json.load(sys.stdin))
+    else:
+        results = load(args.input)
+
+    expanded = results.expand()
+    if args.out == "-":
+        json.dump(expanded, sys.stdout, indent=4)
+        sys.stdout.write("\n")
+    else:
+        with open(args.out, "w") as f:
+            json.dump(expanded, f, indent=4)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,249 @@
+"""Rule-driven mapping of new macro ports onto the ports of the instance being replaced.
+
+Rules are tried in order for every new port; the first rule that finds an old port
+decides. Old port names are indexed once (by exact name and by normalized name), so every
+rule is a constant number of hash lookups per new port and mapping is linear in the
+number of ports.
+
+A rule file is JSON:
+
+    {
+      "normalize": {"lower": true, "strip": "_"},
+      "rules": [
+        {"type": "exact"},
+        {"type": "exact", "map": {"WEN": "CW"}},
+        {"type": "normalized"},
+        {"type": "regex", "new": ".*bweb.*", "old": ["bwen", "bweb"],
+         "normalize": true},
+        {"type": "bus", "new": "Q_{i}", "old": "Q[{i}]", "offset": 0}
+      ]
+    }
+
+- exact: the old port with the same name, or with the name given by "map".
+- normalized: the old port whose normalized name equals the new port's.
+- regex: "new" must match the whole new port name; each "old" template is expanded
+  with the match (\\1, \\g<name>) and looked up in order, the first one present wins.
+- bus: bus-index rewrite. "{i}" in "new" matches a decimal index, which is shifted by
+  "offset" and substituted into "old" ("Q_7" -> "Q[7]", "A[0]" -> "ADDR_0", ...).
+
+Rules with "normalize": true compare normalized names on both sides. A lookup that hits
+several old ports (e.g. "A_B" and "AB" under normalization) leaves the new port unmapped
+and is reported as ambiguous.
+"""
+
+import json
+import re
+from dataclasses import dataclass, field
+
+# Reproduces the original built-in heuristics of replacer.map_ports.
+DEFAULT_RULES = {
+    "normalize": {"lower": True, "strip": "_"},
+    "rules": [
+        {"type": "exact"},
+        {"type": "normalized"},
+        {"type": "regex", "new": ".*clk.*", "old": "clk", "normalize": True},
+        {"type": "exact", "map": {"wen": "cw"}, "normalize": True},
+        {
+            "type": "regex",
+            "new": ".*bweb.*",
+            "old": ["bwen", "bweb"],
+            "normalize": True,
+        },
+    ],
+}
+
+
+class PortRuleError(ValueError):
+    """Raised for malformed rule files."""
+
+
+@dataclass
+class PortMapResult:
+    """Mapping of one instance: (new, old or None) in new-port order, plus problems."""
+
+    pairs: list = field(default_factory=list)
+    rules: dict = field(default_factory=dict)  # new port -> index of the deciding rule
+    unmapped: list = field(default_factory=list)
+    ambiguous: list = field(default_factory=list)
+    unused: list = field(default_factory=list)
+
+    def to_dict(self):
+        return {
+            "mapped": {
+                new: {"old": old, "rule": self.rules[new]}
+                for new, old in self.pairs
+                if old is not None
+            },
+            "unmapped": self.unmapped,
+            "ambiguous": self.ambiguous,
+            "unused": self.unused,
+        }
+
+
+class _OldPortIndex:
+    """Hash indexes over the old port names, built once per instance."""
+
+    def __init__(self, names, normalize):
+        self.exact = set(names)
+        self.normalized = {}
+        for name in names:
+            self.normalized.setdefault(normalize(name), []).append(name)
+
+    def lookup(self, key, normalized):
+        """Old ports for a key: [] if none, several if ambiguous."""
+        if normalized:
+            return self.normalized.get(key, [])
+        return [key] if key in self.exact else []
+
+
+class _Rule:
+    def __init__(self, spec, index, normalize):
+        self.spec = spec
+        self.index = index
+        self.normalized = bool(spec.get("normalize", False))
+        self.normalize = normalize
+
+    def key(self, name):
+        return self.normalize(name) if self.normalized else name
+
+    def candidates(self, new_name):
+        """Old-name lookup keys for a new port, in priority order."""
+        raise NotImplementedError
+
+
+class _ExactRule(_Rule):
+    def __init__(self, spec, index, normalize):
+        super().__init__(spec, index, normalize)
+        renames = spec.get("map")
+        self.renames = (
+            None if renames is None else {self.key(k): v for k, v in renames.items()}
+        )
+
+    def candidates(self, new_name):
+        key = self.key(new_name)
+        if self.renames is None:
+            return [key]
+        old = self.renames.get(key)
+        return [] if old is None else [self.key(old)]
+
+
+class _NormalizedRule(_Rule):
+    def __init__(self, spec, index, normalize):
+        super().__init__(spec, index, normalize)
+        self.normalized = True
+
+    def candidates(self, new_name):
+        return [self.normalize(new_name)]
+
+
+class _RegexRule(_Rule):
+    def __init__(self, spec, index, normalize):
+        super().__init__(spec, index, normalize)
+        try:
+            self.pattern = re.compile(spec["new"])
+        except (KeyError, re.error) as e:
+            raise PortRuleError(f"rule {index}: bad 'new' pattern: {e}") from e
+        old = spec.get("old")
+        if old is None:
+            raise PortRuleError(f"rule {index}: missing 'old'")
+        self.templates = [old] if isinstance(old, str) else list(old)
+
+    def candidates(self, new_name):
+        match = self.pattern.fullmatch(self.key(new_name))
+        if not match:
+            return []
+        return [self.key(match.expand(template)) for template in self.templates]
+
+
+class _BusRule(_Rule):
+    def __init__(self, spec, index, normalize):
+        super().__init__(spec, index, normalize)
+        try:
+            new, self.old = spec["new"], spec["old"]
+        except KeyError as e:
+            raise PortRuleError(f"rule {index}: missing {e}") from e
+        if "{i}" not in new or "{i}" not in self.old:
+            raise PortRuleError(f"rule {index}: 'new' and 'old' must contain {{i}}")
+        head, _, tail = new.partition("{i}")
+        self.pattern = re.compile(re.escape(head) + r"(\d+)" + re.escape(tail))
+        self.offset = int(spec.get("offset", 0))
+
+    def candidates(self, new_name):
+        match = self.pattern.fullmatch(new_name)
+        if not match:
+            return []
+        bit = int(match.group(1)) + self.offset
+        return [self.key(self.old.replace("{i}", str(bit)))]
+
+
+_RULE_TYPES = {
+    "exact": _ExactRule,
+    "normalized": _NormalizedRule,
+    "regex": _RegexRule,
+    "bus": _BusRule,
+}
+
+
+def _make_normalizer(spec):
+    lower = spec.get("lower", True)
+    table = str.maketrans("", "", spec.get("strip", "_"))
+
+    def normalize(name):
+        name = name.translate(table)
+        return name.lower() if lower else name
+
+    return normalize
+
+
+class PortMapper:
+    """Maps new macro ports to old ones with a compiled rule set."""
+
+    def __init__(self, rules=None):
+        rules = DEFAULT_RULES if rules is None else rules
+        self.normalize = _make_normalizer(rules.get("normalize", {}))
+        self.rules = []
+        for index, spec in enumerate(rules.get("rules", [])):
+            rule_type = _RULE_TYPES.get(spec.get("type"))
+            if rule_type is None:
+                raise PortRuleError(f"rule {index}: unknown type {spec.get('type')!r}")
+            self.rules.append(rule_type(spec, index, self.normalize))
+
+    @classmethod
+    def from_file(cls, path):
+        with open(path, "r") as f:
+            try:
+                rules = json.load(f)
+            except ValueError as e:
+                raise PortRuleError(f"{path}: {e}") from e
+        return cls(rules)
+
+    def map(self, old_names, new_names):
+        old_names = list(old_names)
+        index = _OldPortIndex(old_names, self.normalize)
+        result = PortMapResult()
+        used = set()
+
+        for new_name in new_names:
+            old, rule_index = self._map_one(new_name, index, result)
+            result.pairs.append((new_name, old))
+            if old is None:
+                result.unmapped.append(new_name)
+            else:
+                result.rules[new_name] = rule_index
+                used.add(old)
+
+        result.unused = [name for name in old_names if name not in used]
+        return result
+
+    def _map_one(self, new_name, index, result):
+        for rule in self.rules:
+            for key in rule.candidates(new_name):
+                found = index.lookup(key, rule.normalized)
+                if len(found) == 1:
+                    return found[0], rule.index
+                if found:
+                    result.ambiguous.append(
+                        {"port": new_name, "rule": rule.index, "candidates": found}
+                    )
+                    return None, None
+        return None, None
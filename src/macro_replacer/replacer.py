@@ -2,8 +2,20 @@ import json
 import subprocess
 import os
 import argparse
+import atexit
+import contextlib
+import functools
+import importlib.machinery
+import importlib.util
+import mmap
+import resource
 import sys
 import tempfile
+import threading
+from collections import OrderedDict
+from concurrent.futures import ThreadPoolExecutor
+
+from macro_replacer.portmap import PortMapper, PortRuleError
 
 # Defaults
 VERILOG_FILE = "test_regfile.sv"
@@ -18,231 +30,331 @@ NEW_MACRO_NAME = "test_macro"  # Placeholder, should be derived or passed
 INSPECTOR_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), "inspector/build/inspector")
 # fmt: on
 
+# --stats reports of inspector runs, once collect_inspector_stats() was called.
+_inspector_stats = None
+_inspector_stats_lock = threading.Lock()
+
+
+def collect_inspector_stats():
+    """Have every following inspector run report --stats; see inspector_stats()."""
+    global _inspector_stats
+    _inspector_stats = []
+
+
+def inspector_stats():
+    """Aggregate of the --stats reports collected so far, or None if not collecting."""
+    if _inspector_stats is None:
+        return None
+    with _inspector_stats_lock:
+        return aggregate_stats(_inspector_stats)
+
+
+def aggregate_stats(reports):
+    """Combine inspector --stats reports into one of the same shape.
+
+    Phase times and counters are summed, peak RSS is the maximum, and "runs" counts the
+    inspector runs. Aggregates can be aggregated again.
+    """
+    phases = {}
+    counters = {}
+    total = {"runs": 0, "phases": [], "counters": counters, "peakRssBytes": 0}
+    for report in reports:
+        total["runs"] += report.get("runs", 1)
+        for phase in report.get("phases", []):
+            acc = phases.setdefault(
+                phase["name"], {"name": phase["name"], "wall": 0, "cpu": 0}
+            )
+            acc["wall"] += phase.get("wall", 0)
+            acc["cpu"] += phase.get("cpu", 0)
+        for name, value in report.get("counters", {}).items():
+            counters[name] = counters.get(name, 0) + value
+        total["peakRssBytes"] = max(
+            total["peakRssBytes"], report.get("peakRssBytes", 0)
+        )
+    total["phases"] = list(phases.values())
+    return total
+
 
-def run_inspector(verilog_file, module_name):
+def _run_with_stats(cmd, **kwargs):
+    """subprocess.run for an inspector command, keeping its --stats report."""
+    if _inspector_stats is None:
+        return subprocess.run(cmd, **kwargs)
+
+    fd, stats_path = tempfile.mkstemp(prefix="inspector-stats-", suffix=".json")
+    os.close(fd)
+    try:
+        proc = subprocess.run([*cmd, f"--stats={stats_path}"], **kwargs)
+        with open(stats_path, "r") as f:
+            report = json.load(f)
+    finally:
+        os.remove(stats_path)
+    with _inspector_stats_lock:
+        _inspector_stats.append(report)
+    return proc
+
+
+# Elaborated designs of the slang_inspector module, keyed by their source files. Each holds a
+# whole compilation, so only the most recently used few are kept alive.
+_designs = OrderedDict()
+_designs_lock = threading.Lock()
+_MAX_DESIGNS = 2
+
+# Returned by _query_in_process when the executable has to be run instead.
+_NO_MODULE = object()
+
+
+@functools.cache
+def _inspector_module():
+    """The slang_inspector module (-DINSPECTOR_BUILD_PYTHON=ON), or None.
+
+    Looked up on sys.path, then next to the inspector executable. Setting
+    MACRO_REPLACER_INSPECTOR=exe always runs the executable.
+    """
+    if os.environ.get("MACRO_REPLACER_INSPECTOR") == "exe":
+        return None
+    try:
+        import slang_inspector
+
+        return slang_inspector
+    except ImportError:
+        pass
+    build_dir = os.path.dirname(INSPECTOR_PATH)
+    for suffix in importlib.machinery.EXTENSION_SUFFIXES:
+        path = os.path.join(build_dir, "slang_inspector" + suffix)
+        if os.path.exists(path):
+            spec = importlib.util.spec_from_file_location("slang_inspector", path)
+            module = importlib.util.module_from_spec(spec)
+            spec.loader.exec_module(module)
+            return module
+    return None
+
+
+def _query_in_process(verilog_files, queries, definitions_only=False):
+    """Answer queries in this process, reusing the design elaborated for the same files.
+
+    With definitions_only, instances are not collected and the hierarchy is not walked.
+    Returns a dict keyed by query, None if the design cannot be loaded or nothing was found
+    (like a failing inspector run), or _NO_MODULE if the module is not available. --stats
+    reports come from the executable, so it is used while collecting them.
+    """
+    module = _inspector_module()
+    if module is None or _inspector_stats is not None:
+        return _NO_MODULE
+
+    key = tuple(dict.fromkeys(verilog_files))
+    try:
+        with _designs_lock:
+            design = _designs.get(key)
+            if design is not None:
+                _designs.move_to_end(key)
+        if design is None:
+            # Loaded outside the lock so that designs of different files load in parallel.
+            design = module.Design(list(key))
+            with _designs_lock:
+                design = _designs.setdefault(key, design)
+                _designs.move_to_end(key)
+                while len(_designs) > _MAX_DESIGNS:
+                    _designs.popitem(last=False)
+        queries = list(dict.fromkeys(queries))
+        results = design.query(queries, instances=not definitions_only)
+    except (RuntimeError, ValueError) as e:
+        print(f"inspector 调用失败: {e}")
+        return None
+
+    if not any(result.definition or result.instances for result in results):
+        return None
+    return {query: result.to_dict() for query, result in zip(queries, results)}
+
+
+def run_inspector(verilog_file, module_name, definitions_only=False):
     """Run the inspector tool to get module definition."""
     print(f"正在分析 {verilog_file} 中的模块 {module_name} ...")
+    data = _query_in_process([verilog_file], [module_name], definitions_only)
+    if data is not _NO_MODULE:
+        return data and data[module_name]
+    args = [verilog_file, module_name]
+    if definitions_only:
+        args.append("--definitions-only")
+    return _run_inspector_cmd(args)
+
+
+def run_inspector_queries(verilog_files, queries, definitions_only=False):
+    """Answer several module/definition queries from one inspector run.
+
+    All files are elaborated together once; the result is a dict keyed by query. With
+    definitions_only, only definitions are reported, which skips walking the hierarchy.
+    """
+    print(f"正在分析 {', '.join(verilog_files)} 中的模块 {', '.join(queries)} ...")
+    data = _query_in_process(verilog_files, queries, definitions_only)
+    if data is not _NO_MODULE:
+        return data
+    args = list(dict.fromkeys(verilog_files))
+    for query in dict.fromkeys(queries):
+        args += ["--query", query]
+    if definitions_only:
+        args.append("--definitions-only")
+    return _run_inspector_cmd(args)
+
+
+def _result_decoder():
+    """Pick the most compact result format the inspector and this interpreter share.
+
+    Returns (inspector --format value, decoder for the raw stdout bytes).
+    """
+    try:
+        import cbor2
 
+        return "cbor", cbor2.loads
+    except ImportError:
+        pass
+    try:
+        import msgpack
+
+        return "msgpack", lambda payload: msgpack.unpackb(payload, raw=False)
+    except ImportError:
+        pass
+    return "json", json.loads
+
+
+def _run_inspector_cmd(args):
     if not os.path.exists(INSPECTOR_PATH):
         print(f"Error: inspector executable not found at {INSPECTOR_PATH}")
         sys.exit(1)
 
-    with tempfile.NamedTemporaryFile(mode="w+", suffix=".json", delete=False) as tmp:
-        tmp_json = tmp.name
-
-    cmd = [INSPECTOR_PATH, verilog_file, module_name, "--json", tmp_json]
+    # The result is piped back over stdout and decoded in place; no temp file round trip.
+    fmt, decode = _result_decoder()
+    cmd = [INSPECTOR_PATH, *args, "--format", fmt, "--out", "-"]
 
     try:
-        subprocess.run(
-            cmd, check=True, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE
+        proc = _run_with_stats(
+            cmd, check=True, stdout=subprocess.PIPE, stderr=subprocess.PIPE
         )
-        with open(tmp_json, "r") as f:
-            data = json.load(f)
+        data = decode(proc.stdout)
     except subprocess.CalledProcessError as e:
         print(f"inspector 调用失败: {e}")
-        if os.path.exists(tmp_json):
-            os.remove(tmp_json)
         return None
-    except json.JSONDecodeError:
-        print("Error: Failed to parse inspector JSON output.")
-        if os.path.exists(tmp_json):
-            os.remove(tmp_json)
+    except ValueError:
+        print(f"Error: Failed to parse inspector {fmt} output.")
         return None
 
-    if os.path.exists(tmp_json):
-        os.remove(tmp_json)
-
     return data
 
 
 def get_macro_ports(macro_file, macro_name):
     """Get ports of the new macro using inspector."""
-    data = run_inspector(macro_file, macro_name)
+    data = run_inspector(macro_file, macro_name, definitions_only=True)
     if not data or not data.get("definition"):
         # Fallback to check instances if definition not found (e.g. blackbox) or maybe inspector needs module name
         return []
     return data["definition"].get("ports", [])
 
 
-def main():
-    parser = argparse.ArgumentParser(
-        description="Replace macro instantiation in Verilog file."
-    )
-    parser.add_argument(
-        "--verilog", default=VERILOG_FILE, help="Top level Verilog file"
-    )
-    parser.add_argument(
-        "--module", default=TARGET_MODULE, help="Module containing the macro to replace"
-    )
-    parser.add_argument(
-        "--old-macro", default=OLD_MACRO_NAME, help="Name of the macro to replace"
-    )
-    parser.add_argument(
-        "--new-macro-file", required=True, help="File containing new macro definition"
-    )
-    parser.add_argument(
-        "--new-macro-name", required=True, help="Name of the new macro module"
-    )
-    parser.add_argument("--out", default="replaced_file.sv", help="Output file path")
-
-    args = parser.parse_args()
-
-    verilog_file = args.verilog
-    target_module = args.module
-    old_macro = args.old_macro
-    new_macro_file = args.new_macro_file
-    new_macro_name = args.new_macro_name
-    out_file = args.out
-
-    # 1. Analyze the Target Module to find the Old Macro Instance
-    target_data = run_inspector(verilog_file, target_module)
-    if not target_data:
-        print("Failed to analyze target module.")
-        return
+def map_ports(existing_connections, new_macro_ports, mapper=None, report=None):
+    """Map each new macro port to an old port's signal.
 
-    # Find the instance in definition -> instances (nested)
-    def_info = target_data.get("definition", {})
-    sub_instances = def_info.get("instances", [])
+    Ports are matched by a PortMapper (the built-in rules unless one is given). Returns a
+    list of (new_port, old_port or None, signal) in new-port order. If report is a list,
+    the structured mapping result (mapped, unmapped, ambiguous, unused) is appended to it.
+    """
+    mapper = mapper or PortMapper()
+    result = mapper.map(existing_connections, [p["name"] for p in new_macro_ports])
 
-    target_instance = None
-    for inst in sub_instances:
-        if inst.get("definitionName") == old_macro:
-            target_instance = inst
-            break
+    mapping = []
+    for np_name, old_port in result.pairs:
+        if old_port is not None:
+            signal = existing_connections[old_port]
+            mapping.append((np_name, old_port, signal))
+            if old_port != np_name:
+                print(f"Mapped {np_name} <- {signal} (via old port {old_port})")
+        else:
+            print(f"Warning: Could not automatically map port '{np_name}'")
+            mapping.append((np_name, None, "/* UNCONNECTED */"))
 
-    if not target_instance:
+    for entry in result.ambiguous:
         print(
-            f"Error: Instance of macro '{old_macro}' not found in module '{target_module}'."
+            f"Warning: Port '{entry['port']}' matches several old ports: {', '.join(entry['candidates'])}"
         )
-        # Try checking if it's in the instances list at top level (unlikely for blackbox internal)
-        return
+    if report is not None:
+        report.append(result.to_dict())
+    return mapping
 
-    print(
-        f"Found instance '{target_instance['instanceName']}' at offsets {target_instance['startOffset']}-{target_instance['endOffset']}"
-    )
 
-    # 2. Extract Existing Connections
-    # Map PortName -> SignalExpression (string)
-    # The inspector now returns 'signalType' as the expression string if available from syntax
+def all_macro_instances(verilog_file, old_macro):
+    """Every instantiation of old_macro in verilog_file, in any module, or None on failure.
 
-    existing_connections = {}
-    for conn in target_instance.get("connections", []):
-        port = conn.get("portName")
-        signal = conn.get(
-            "signalType"
-        )  # This holds the expression string now, e.g. "clk_i" or "dat_i[63:0]"
-        if port and signal:
-            existing_connections[port] = signal
-
-    print("Existing Connections:", existing_connections)
-
-    # 3. Analyze New Macro to get its Ports
-    new_macro_ports = get_macro_ports(new_macro_file, new_macro_name)
-    if not new_macro_ports:
-        print(
-            f"Failed to get ports for new macro '{new_macro_name}' from '{new_macro_file}'."
-        )
-        # Generate some dummy ports for testing if file doesn't match macro name or such
-        # new_macro_ports = [{'name': 'CLK', 'direction': 'Input'}, {'name': 'CEN', 'direction': 'Input'}, {'name': 'WEN', 'direction': 'Input'}, {'name': 'A', 'direction': 'Input'}, {'name': 'D', 'direction': 'Input'}, {'name': 'BWEN', 'direction': 'Input'}, {'name': 'Q', 'direction': 'Output'}]
-        # return
-        pass
-
-    # Fallback if inspector returned nothing (e.g. invalid macro file passed in command line but valid for this tool context)
-    if not new_macro_ports:
-        print("Warning: No ports found for new macro. Instantiation will be empty.")
-
-    print(f"New Macro Ports: {[p['name'] for p in new_macro_ports]}")
+    Read from the syntax like --replace does, so it covers exactly the instantiations the
+    native rewrite touches, including those in modules the design never elaborates.
+    """
+    data = _run_inspector_cmd([verilog_file, "--query", old_macro, "--syntax-only"])
+    result = data.get(old_macro) if data else None
+    return result["instances"] if result else None
 
-    # 4. Map Signals to New Ports (Heuristic)
-    new_connections = []
-
-    # Helper to clean names for matching
-    def clean(s):
-        return s.lower().replace("_", "")
-
-    for new_port in new_macro_ports:
-        np_name = new_port["name"]
-
-        # Heuristic 1: Exact Match
-        if np_name in existing_connections:
-            signal = existing_connections[np_name]
-            new_connections.append((np_name, signal))
-            continue
-
-        # Heuristic 2: Fuzzy Name Match
-        best_old_port = None
-        for old_port, signal in existing_connections.items():
-            if clean(old_port) == clean(np_name):
-                best_old_port = old_port
-                break
-
-            # Common renames
-            if clean(old_port) == "clk" and "clk" in clean(np_name):
-                best_old_port = old_port
-            if clean(old_port) == "cw" and clean(np_name) == "wen":
-                best_old_port = old_port
-
-            # Map BWEB (new) to BWEN (old) or BWEB (old)
-            if "bweb" in clean(np_name) and clean(old_port) in ["bwen", "bweb"]:
-                best_old_port = old_port
-            # ... add more heuristics as needed
-
-        # Special casing for the specific macro if needed
-        if not best_old_port and np_name == "CLK":
-            best_old_port = "CLK"
-
-        if best_old_port and best_old_port in existing_connections:
-            signal = existing_connections[best_old_port]
-            new_connections.append((np_name, signal))
-            print(f"Mapped {np_name} <- {signal} (via old port {best_old_port})")
-        else:
-            # Try finding signal by name if port mapping fails?
-            # e.g. if new port is "addr", maybe connect to "addr_i"?
-            if "clk" in clean(np_name):
-                # simplistic
-                pass
 
-            print(f"Warning: Could not automatically map port '{np_name}'")
-            new_connections.append((np_name, "/* UNCONNECTED */"))
+def run_inspector_replace(verilog_file, old_macro, new_macro_name, port_map, out_file):
+    """Rewrite every instantiation of old_macro in verilog_file using the inspector."""
+    if not os.path.exists(INSPECTOR_PATH):
+        print(f"Error: inspector executable not found at {INSPECTOR_PATH}")
+        sys.exit(1)
 
-    # 5. Generate New Instantiation Text
+    cmd = [
+        INSPECTOR_PATH,
+        verilog_file,
+        "--replace",
+        "--old-macro",
+        old_macro,
+        "--new-macro",
+        new_macro_name,
+        "--out",
+        out_file,
+    ]
+    for old_port, new_port in port_map.items():
+        cmd += ["--port", f"{old_port}={new_port}"]
 
-    indent = "      "
+    try:
+        _run_with_stats(cmd, check=True, stderr=subprocess.PIPE)
+    except subprocess.CalledProcessError as e:
+        print(f"inspector 调用失败: {e}")
+        return False
+    return True
 
-    new_inst_lines = []
-    new_inst_lines.append(f"  {new_macro_name} {target_instance['instanceName']} (")
 
-    for i, (port, sig) in enumerate(new_connections):
-        comma = "," if i < len(new_connections) - 1 else ""
-        new_inst_lines.append(f"{indent}.{port: <10} ({sig}){comma}")
+_SPACE = frozenset(b" \t\r\n\v\f")
+_IDENT = frozenset(b"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_")
 
-    new_inst_lines.append("  );")
 
-    new_inst_text = "\n".join(new_inst_lines)
+@contextlib.contextmanager
+def open_source(path):
+    """Map a source file read-only.
 
-    # 6. Apply Replacement
-    with open(verilog_file, "r") as f:
-        content = f.read()
+    The inspector reports byte offsets, so the file is handled as bytes. Nothing is copied
+    into a Python string; pages are read on demand by the OS.
+    """
+    with open(path, "rb") as f:
+        if os.fstat(f.fileno()).st_size == 0:
+            yield b""
+            return
+        with mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as mm:
+            yield mm
 
-    start = target_instance["startOffset"]
-    end = target_instance["endOffset"]
 
+def expand_instance_range(content, start, end, old_macro):
+    """Widen an instance's [start, end) to cover the macro type name and trailing ';'."""
     # Heuristic: Search backwards for the macro type name
     # The syntax tree range for UninstantiatedDef might only cover the instance variable, not the type.
 
     # scan backwards from start
     cursor = start - 1
-    while cursor >= 0 and content[cursor].isspace():
+    while cursor >= 0 and content[cursor] in _SPACE:
         cursor -= 1
 
     # Now cursor is at end of the previous token.
     # Find the start of that token.
     token_end = cursor + 1
-    while cursor >= 0 and (content[cursor].isalnum() or content[cursor] == "_"):
+    while cursor >= 0 and content[cursor] in _IDENT:
         cursor -= 1
     token_start = cursor + 1
 
-    preceding_word = content[token_start:token_end]
+    preceding_word = bytes(content[token_start:token_end]).decode(errors="replace")
     print(f"Preceding word: '{preceding_word}'")
 
     if preceding_word == old_macro:
@@ -255,18 +367,495 @@ def main():
 
     # Also consume the trailing semicolon from the original content if present
     cursor = end
-    while cursor < len(content) and content[cursor].isspace():
+    while cursor < len(content) and content[cursor] in _SPACE:
         cursor += 1
-    if cursor < len(content) and content[cursor] == ";":
+    if cursor < len(content) and content[cursor] == ord(";"):
         print(f"Consuming trailing semicolon at {cursor}")
         end = cursor + 1
 
-    new_content = content[:start] + new_inst_text + content[end:]
+    return start, end
+
+
+def write_with_edits(content, edits, out_file):
+    """Stream content to out_file with (start, end, text) edits applied.
+
+    Unchanged regions are written straight from the mapping through memoryviews, so the
+    output never exists as a second full copy in memory.
+    """
+    # The view is released even if a write fails; an exported view would make closing the
+    # mapping raise BufferError and hide the original error.
+    pos = 0
+    with memoryview(content) as view, open(out_file, "wb") as out:
+        for start, end, text in sorted(edits, key=lambda edit: edit[0]):
+            out.write(view[pos:start])
+            out.write(text.encode())
+            pos = end
+        out.write(view[pos:])
+
+
+def find_macro_instances(target_data, old_macro):
+    """All instances of old_macro directly inside the analysed module, in source order."""
+    def_info = target_data.get("definition") or {}
+    return [
+        inst
+        for inst in def_info.get("instances", [])
+        if inst.get("definitionName") == old_macro
+    ]
+
+
+def existing_connections_of(instance):
+    """Map PortName -> SignalExpression (string) for an instance."""
+    # The inspector returns 'signalType' as the expression string if available from syntax
+    existing_connections = {}
+    for conn in instance.get("connections", []):
+        port = conn.get("portName")
+        signal = conn.get(
+            "signalType"
+        )  # This holds the expression string now, e.g. "clk_i" or "dat_i[63:0]"
+        if port and signal:
+            existing_connections[port] = signal
+    return existing_connections
+
 
-    with open(out_file, "w") as f:
-        f.write(new_content)
+def resolve_macro_ports(query_data, new_macro_file, new_macro_name):
+    """Ports of the new macro, from a query result or a separate inspector run."""
+    # The macro file is loaded with the design, so the definition is normally part of the
+    # query result (from the definition table if nothing instantiates it); otherwise inspect
+    # the macro file on its own.
+    macro_def = (query_data.get(new_macro_name) or {}).get("definition")
+    if macro_def:
+        return macro_def.get("ports", [])
+    return _cached_macro_ports(new_macro_file, new_macro_name)
 
-    print(f"Successfully generated {out_file} with replaced macro.")
+
+@functools.lru_cache(maxsize=None)
+def _cached_macro_ports(macro_file, macro_name):
+    # Shared by all manifest jobs that use the same macro.
+    return get_macro_ports(macro_file, macro_name)
+
+
+def build_instance_text(new_macro_name, instance_name, port_mapping):
+    """Generate the replacement instantiation text."""
+    new_connections = [(new, signal) for new, _, signal in port_mapping]
+
+    indent = "      "
+
+    new_inst_lines = []
+    new_inst_lines.append(f"  {new_macro_name} {instance_name} (")
+
+    for i, (port, sig) in enumerate(new_connections):
+        comma = "," if i < len(new_connections) - 1 else ""
+        new_inst_lines.append(f"{indent}.{port: <10} ({sig}){comma}")
+
+    new_inst_lines.append("  );")
+
+    return "\n".join(new_inst_lines)
+
+
+def map_instance_ports(instance, new_macro_name, new_macro_ports, mapper, report):
+    """map_ports for one instance; its report entry is labelled with the instance."""
+    existing_connections = existing_connections_of(instance)
+    print("Existing Connections:", existing_connections)
+
+    instance_report = [] if report is not None else None
+    port_mapping = map_ports(
+        existing_connections, new_macro_ports, mapper, instance_report
+    )
+    if instance_report:
+        report.append(
+            {
+                "instance": instance.get("fullPath") or instance["instanceName"],
+                "newMacro": new_macro_name,
+                **instance_report[0],
+            }
+        )
+    return port_mapping
+
+
+def native_port_map(instances, new_macro_name, new_macro_ports, mapper, report):
+    """The old -> new port renames that turn every instance into the new macro, or None.
+
+    The inspector's native rewrite renames named connections in place and nothing else, so
+    its output only matches the rebuilt instantiations when every instance connects its ports
+    by name, each old port maps to exactly one new port and back, and all instances agree.
+    """
+    renames = None
+    for instance in instances:
+        name = instance["instanceName"]
+        ports = [conn.get("portName", "") for conn in instance.get("connections", [])]
+        if any(port.startswith("[Positional") for port in ports):
+            print(f"Instance '{name}' connects ports by position.")
+            return None
+
+        port_mapping = map_instance_ports(
+            instance, new_macro_name, new_macro_ports, mapper, report
+        )
+        olds = [old for _, old, _ in port_mapping if old]
+        unmapped = [new for new, old, _ in port_mapping if not old]
+        unused = set(ports) - set(olds)
+        if unmapped or unused or len(set(olds)) != len(olds):
+            print(
+                f"Instance '{name}': new ports {unmapped} unmapped, old ports {sorted(unused)} unused."
+            )
+            return None
+
+        instance_renames = {old: new for new, old, _ in port_mapping}
+        if renames is not None and instance_renames != renames:
+            print(f"Instance '{name}' maps its ports differently from the others.")
+            return None
+        renames = instance_renames
+    return {old: new for old, new in renames.items() if old != new}
+
+
+def plan_instance_edits(
+    content,
+    instances,
+    old_macro,
+    new_macro_name,
+    new_macro_ports,
+    mapper=None,
+    report=None,
+):
+    """Build (start, end, text) edits replacing each instance with the new macro.
+
+    With a report list, one port mapping report per instance is appended to it.
+    """
+    edits = []
+    for instance in instances:
+        print(
+            f"Found instance '{instance['instanceName']}' at offsets {instance['startOffset']}-{instance['endOffset']}"
+        )
+        port_mapping = map_instance_ports(
+            instance, new_macro_name, new_macro_ports, mapper, report
+        )
+        text = build_instance_text(
+            new_macro_name, instance["instanceName"], port_mapping
+        )
+        start, end = expand_instance_range(
+            content, instance["startOffset"], instance["endOffset"], old_macro
+        )
+        edits.append((start, end, text))
+    return edits
+
+
+def load_manifest(path):
+    """Read replacement jobs from a JSON manifest.
+
+    The manifest is a list of jobs, or {"jobs": [...]}. Each job has the keys of the
+    command line options: verilog, module, old_macro, new_macro_file, new_macro_name and
+    optionally out (default: "<verilog stem>_replaced<ext>"). Jobs on the same verilog
+    file must agree on out.
+    """
+    with open(path, "r") as f:
+        data = json.load(f)
+    jobs = data["jobs"] if isinstance(data, dict) else data
+
+    base_dir = os.path.dirname(os.path.abspath(path))
+    by_file = {}
+    for job in jobs:
+        job = dict(job)
+        for key in ("verilog", "new_macro_file", "out"):
+            if key in job:
+                job[key] = os.path.join(base_dir, job[key])
+        if "out" not in job:
+            stem, ext = os.path.splitext(job["verilog"])
+            job["out"] = f"{stem}_replaced{ext}"
+        by_file.setdefault(job["verilog"], []).append(job)
+
+    for verilog_file, file_jobs in by_file.items():
+        outs = {job["out"] for job in file_jobs}
+        if len(outs) > 1:
+            raise ValueError(
+                f"Jobs on {verilog_file} write to different outputs: {sorted(outs)}"
+            )
+    return by_file
+
+
+def replace_in_file(verilog_file, jobs, mapper=None, report=None):
+    """Apply every job on one verilog file with a single inspector run and one write.
+
+    Returns the number of replaced instances.
+    """
+    macro_files = [job["new_macro_file"] for job in jobs]
+    queries = [job["module"] for job in jobs] + [job["new_macro_name"] for job in jobs]
+    # Replacement only reads the definitions' own child instances, never the walked ones.
+    query_data = run_inspector_queries(
+        [verilog_file, *macro_files], queries, definitions_only=True
+    )
+    if not query_data:
+        raise RuntimeError(f"Failed to analyze {verilog_file}.")
+
+    out_file = jobs[0]["out"]
+    with open_source(verilog_file) as content:
+        edits = {}
+        for job in jobs:
+            target_data = query_data.get(job["module"])
+            instances = find_macro_instances(target_data or {}, job["old_macro"])
+            if not instances:
+                raise RuntimeError(
+                    f"Instance of macro '{job['old_macro']}' not found in module '{job['module']}' of {verilog_file}."
+                )
+            new_macro_ports = resolve_macro_ports(
+                query_data, job["new_macro_file"], job["new_macro_name"]
+            )
+            if not new_macro_ports:
+                print(
+                    f"Warning: No ports found for new macro '{job['new_macro_name']}'. Instantiation will be empty."
+                )
+            for start, end, text in plan_instance_edits(
+                content,
+                instances,
+                job["old_macro"],
+                job["new_macro_name"],
+                new_macro_ports,
+                mapper,
+                report,
+            ):
+                # The same module may be listed by more than one job; keep the first.
+                edits.setdefault((start, end), text)
+
+        ordered = sorted(edits.items())
+        for ((_, prev_end), _), ((start, _), _) in zip(ordered, ordered[1:]):
+            if start < prev_end:
+                raise RuntimeError(f"Overlapping edits in {verilog_file} at {start}.")
+        write_with_edits(
+            content, [(start, end, text) for (start, end), text in ordered], out_file
+        )
+
+    print(f"Successfully generated {out_file} with {len(edits)} replaced instance(s).")
+    return len(edits)
+
+
+def run_manifest(manifest_path, workers, mapper=None, report=None):
+    """Run all manifest jobs, one worker per verilog file. Returns True if all succeeded."""
+    by_file = load_manifest(manifest_path)
+    failed = []
+    lock = threading.Lock()
+
+    def work(item):
+        verilog_file, jobs = item
+        try:
+            return replace_in_file(verilog_file, jobs, mapper, report)
+        except (OSError, RuntimeError) as e:
+            with lock:
+                failed.append(verilog_file)
+            print(f"Error: {e}")
+            return 0
+
+    # Workers mostly wait on inspector subprocesses, so threads are enough.
+    with ThreadPoolExecutor(max_workers=workers) as pool:
+        replaced = sum(pool.map(work, by_file.items()))
+
+    print(
+        f"Manifest done: {replaced} instance(s) replaced in {len(by_file) - len(failed)}/{len(by_file)} file(s)."
+    )
+    return not failed
+
+
+def write_port_report(path, report):
+    """Write the per-instance port mapping reports as JSON."""
+    with open(path, "w") as f:
+        json.dump(report, f, indent=4)
+    problems = sum(1 for entry in report if entry["unmapped"] or entry["ambiguous"])
+    print(f"Port report: {len(report)} instance(s), {problems} with unmapped ports -> {path}")
+
+
+def write_inspector_stats(path):
+    """Write the aggregated inspector statistics and print a one-line summary."""
+    stats = inspector_stats()
+    with open(path, "w") as f:
+        json.dump(stats, f, indent=4)
+    wall = sum(phase["wall"] for phase in stats["phases"] if phase["name"] == "total")
+    print(
+        f"Inspector stats: {stats['runs']} run(s), {wall:.2f}s total, peak RSS {stats['peakRssBytes'] / 2**20:.1f} MiB -> {path}"
+    )
+
+
+def report_peak_rss():
+    """Print peak resident memory of this process and of the inspector runs."""
+    scale = 1 if sys.platform == "darwin" else 1024  # ru_maxrss: bytes on macOS, KiB on Linux
+    own = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss * scale
+    children = resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss * scale
+    print(f"Peak RSS: replacer {own / 2**20:.1f} MiB, inspector {children / 2**20:.1f} MiB")
+
+
+def replace_native(
+    verilog_file, old_macro, new_macro_name, new_macro_ports, out_file, mapper, report
+):
+    """Let the inspector rewrite every instantiation in place; returns whether it did.
+
+    It renames port tokens and streams everything else in the file through unchanged,
+    in every module, so the rename map must hold for every instantiation in the file,
+    not just those of --module.
+    """
+    instances = all_macro_instances(verilog_file, old_macro)
+    if not instances:
+        print(f"Error: Failed to list instances of '{old_macro}' in {verilog_file}.")
+        return False
+    port_map = native_port_map(
+        instances, new_macro_name, new_macro_ports, mapper, report
+    )
+    if port_map is None:
+        print(
+            "Error: --native only renames ports; run without --native to rebuild the instantiations."
+        )
+        return False
+    if not run_inspector_replace(
+        verilog_file, old_macro, new_macro_name, port_map, out_file
+    ):
+        print("Native replacement failed.")
+        return False
+    return True
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Replace macro instantiation in Verilog file."
+    )
+    parser.add_argument(
+        "--verilog", default=VERILOG_FILE, help="Top level Verilog file"
+    )
+    parser.add_argument(
+        "--module", default=TARGET_MODULE, help="Module containing the macro to replace"
+    )
+    parser.add_argument(
+        "--old-macro", default=OLD_MACRO_NAME, help="Name of the macro to replace"
+    )
+    parser.add_argument(
+        "--new-macro-file", help="File containing new macro definition"
+    )
+    parser.add_argument("--new-macro-name", help="Name of the new macro module")
+    parser.add_argument("--out", default="replaced_file.sv", help="Output file path")
+    parser.add_argument(
+        "--native",
+        action="store_true",
+        help="Rewrite all old macro instantiations in place with the inspector",
+    )
+    parser.add_argument(
+        "--report-rss",
+        action="store_true",
+        help="Print peak resident memory of the replacer and the inspector",
+    )
+    parser.add_argument(
+        "--stats",
+        metavar="FILE",
+        help="Write the aggregated --stats reports of all inspector runs to FILE",
+    )
+    parser.add_argument(
+        "--port-rules",
+        metavar="FILE",
+        help="JSON port mapping rules (default: built-in name heuristics)",
+    )
+    parser.add_argument(
+        "--port-report",
+        metavar="FILE",
+        help="Write mapped, unmapped, ambiguous and unused ports per instance to FILE",
+    )
+    parser.add_argument(
+        "--manifest",
+        help="JSON list of replacement jobs to run instead of the single job above",
+    )
+    parser.add_argument(
+        "--jobs",
+        type=int,
+        default=os.cpu_count(),
+        help="Number of files processed concurrently with --manifest",
+    )
+
+    args = parser.parse_args()
+
+    if args.stats:
+        collect_inspector_stats()
+        atexit.register(write_inspector_stats, args.stats)
+
+    try:
+        mapper = PortMapper.from_file(args.port_rules) if args.port_rules else None
+    except (OSError, PortRuleError) as e:
+        parser.error(f"--port-rules: {e}")
+    port_report = [] if args.port_report else None
+    if port_report is not None:
+        atexit.register(write_port_report, args.port_report, port_report)
+
+    if args.manifest:
+        ok = run_manifest(args.manifest, args.jobs, mapper, port_report)
+        if args.report_rss:
+            report_peak_rss()
+        if not ok:
+            sys.exit(1)
+        return
+
+    if not args.new_macro_file or not args.new_macro_name:
+        parser.error(
+            "--new-macro-file and --new-macro-name are required without --manifest"
+        )
+
+    verilog_file = args.verilog
+    target_module = args.module
+    old_macro = args.old_macro
+    new_macro_file = args.new_macro_file
+    new_macro_name = args.new_macro_name
+    out_file = args.out
+
+    # 1. Analyze the Target Module to find the Old Macro Instances. The design and the new
+    # macro are elaborated together so both answers come from a single inspector run.
+    query_data = run_inspector_queries(
+        [verilog_file, new_macro_file],
+        [target_module, new_macro_name],
+        definitions_only=True,
+    )
+    target_data = query_data.get(target_module) if query_data else None
+    if not target_data:
+        print("Failed to analyze target module.")
+        return
+
+    # Find the instances in definition -> instances (nested)
+    target_instances = find_macro_instances(target_data, old_macro)
+    if not target_instances:
+        print(
+            f"Error: Instance of macro '{old_macro}' not found in module '{target_module}'."
+        )
+        return
+
+    # 2. Analyze New Macro to get its Ports.
+    new_macro_ports = resolve_macro_ports(query_data, new_macro_file, new_macro_name)
+    if not new_macro_ports:
+        print(
+            f"Failed to get ports for new macro '{new_macro_name}' from '{new_macro_file}'."
+        )
+        print("Warning: No ports found for new macro. Instantiation will be empty.")
+
+    print(f"New Macro Ports: {[p['name'] for p in new_macro_ports]}")
+
+    if args.native:
+        replaced = replace_native(
+            verilog_file,
+            old_macro,
+            new_macro_name,
+            new_macro_ports,
+            out_file,
+            mapper,
+            port_report,
+        )
+    else:
+        # 3. Map signals to new ports (heuristic), generate each new instantiation and apply
+        # all of them in one pass over the file.
+        with open_source(verilog_file) as content:
+            edits = plan_instance_edits(
+                content,
+                target_instances,
+                old_macro,
+                new_macro_name,
+                new_macro_ports,
+                mapper,
+                port_report,
+            )
+            write_with_edits(content, edits, out_file)
+        replaced = True
+
+    if replaced:
+        print(f"Successfully generated {out_file} with replaced macro.")
+    if args.report_rss:
+        report_peak_rss()
 
 
 if __name__ == "__main__":
@@ -1,5 +1,10 @@
+import json
 import sys
 import os
+import socket
+import subprocess
+import tempfile
+import time
 import unittest
 from unittest import mock
 
@@ -9,6 +14,7 @@ sys.path.insert(
 )
 
 from macro_replacer import replacer
+from macro_replacer.compact import CompactResults
 
 
 class TestIntegration(unittest.TestCase):
@@ -123,6 +129,827 @@ class TestIntegration(unittest.TestCase):
         if os.path.exists(output_file):
             os.remove(output_file)
 
+    def test_case1_native(self):
+        verilog_file = os.path.join(self.case1_dir, "top_module.sv")
+        new_macro_file = os.path.join(self.case1_dir, "new_macro.v")
+
+        argv = [
+            "replacer.py",
+            "--verilog",
+            verilog_file,
+            "--module",
+            "top_module",
+            "--old-macro",
+            "OLD_MACRO",
+            "--new-macro-file",
+            new_macro_file,
+            "--new-macro-name",
+            "NEW_MACRO",
+            "--out",
+            self.output_file,
+            "--native",
+        ]
+
+        with mock.patch("sys.argv", argv):
+            replacer.main()
+
+        with open(self.output_file, "r") as f:
+            content = f.read()
+
+        # Native mode renames tokens in place and keeps the original formatting.
+        self.assertIn("NEW_MACRO u_inst (", content)
+        self.assertIn(".WEN(wen),", content)
+        self.assertIn(".CLK(clk),", content)
+        self.assertNotIn("OLD_MACRO", content)
+        self.assertNotIn(".CW(", content)
+
+    def test_case2_native(self):
+        case_dir = os.path.join(self.base_dir, "test_cases/case2")
+        output_file = os.path.join(case_dir, "output.sv")
+        argv = [
+            "replacer.py",
+            "--verilog",
+            os.path.join(case_dir, "top.sv"),
+            "--module",
+            "top",
+            "--old-macro",
+            "OLD_MACRO",
+            "--new-macro-file",
+            os.path.join(case_dir, "new_macro.v"),
+            "--new-macro-name",
+            "NEW_MACRO",
+            "--out",
+            output_file,
+            "--native",
+        ]
+
+        # X and Y have no old port to be renamed from; a native rewrite would drop them.
+        with mock.patch("sys.argv", argv):
+            replacer.main()
+        self.assertFalse(os.path.exists(output_file))
+
+    def test_native_checks_every_module(self):
+        # --native rewrites other modules too; their instances must pass the same check.
+        design = """
+        module top(input c, w, input [3:0] d, output [3:0] q);
+          OLD_MACRO u_inst (.CLK(c), .CW(w), .D(d), .Q(q));
+        endmodule
+        module other(input c, w, input [3:0] d, output [3:0] q);
+          OLD_MACRO u_pos (c, w, d, q);
+        endmodule
+        """
+        with tempfile.TemporaryDirectory() as tmp:
+            verilog_file = os.path.join(tmp, "top.sv")
+            output_file = os.path.join(tmp, "output.sv")
+            with open(verilog_file, "w") as f:
+                f.write(design)
+            argv = [
+                "replacer.py",
+                "--verilog",
+                verilog_file,
+                "--module",
+                "top",
+                "--old-macro",
+                "OLD_MACRO",
+                "--new-macro-file",
+                os.path.join(self.case1_dir, "new_macro.v"),
+                "--new-macro-name",
+                "NEW_MACRO",
+                "--out",
+                output_file,
+                "--native",
+            ]
+            with mock.patch("sys.argv", argv):
+                replacer.main()
+            self.assertFalse(os.path.exists(output_file))
+
+    def test_replace_layout(self):
+        with tempfile.TemporaryDirectory() as tmp:
+            sources = []
+            for sub in ("a", "b"):
+                os.makedirs(os.path.join(tmp, sub))
+                sources.append(os.path.join(tmp, sub, "chip.sv"))
+                with open(sources[-1], "w") as f:
+                    f.write(f"module {sub}; OLD_MACRO u (.CW(w)); endmodule\n")
+            with open(os.path.join(tmp, "a", "defs.svh"), "w") as f:
+                f.write("`define WIDTH 4\n")
+            with open(sources[0], "a") as f:
+                f.write('`include "defs.svh"\n')
+
+            replace = ["--replace", "--old-macro", "OLD_MACRO", "--new-macro", "NEW"]
+            replace += ["--port", "CW=WEN", "--out"]
+
+            # A single source is rewritten to a file, whatever it includes.
+            out_file = os.path.join(tmp, "single.sv")
+            cmd = [self.inspector_path, sources[0], *replace, out_file]
+            subprocess.run(cmd, check=True, stdout=subprocess.PIPE)
+            with open(out_file, "r") as f:
+                self.assertIn("NEW u (.WEN(w));", f.read())
+
+            # Same-named files keep their directories.
+            out_dir = os.path.join(tmp, "out")
+            cmd = [self.inspector_path, *sources, *replace, out_dir]
+            subprocess.run(cmd, check=True, stdout=subprocess.PIPE)
+            for sub in ("a", "b"):
+                with open(os.path.join(out_dir, sub, "chip.sv"), "r") as f:
+                    self.assertIn(f"module {sub}; NEW u (.WEN(w));", f.read())
+
+            # Positional connections cannot be renamed.
+            positional = os.path.join(tmp, "positional.sv")
+            with open(positional, "w") as f:
+                f.write("module p; OLD_MACRO u (w); endmodule\n")
+            out_file = os.path.join(tmp, "positional_out.sv")
+            proc = subprocess.run(
+                [self.inspector_path, positional, *replace, out_file],
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+            )
+            self.assertNotEqual(proc.returncode, 0)
+            self.assertFalse(os.path.exists(out_file))
+
+    def test_filelist(self):
+        verilog_file = os.path.join(self.case1_dir, "top_module.sv")
+        new_macro_file = os.path.join(self.case1_dir, "new_macro.v")
+        queries = [
+            "--query",
+            "OLD_MACRO",
+            "--query",
+            "NEW_MACRO",
+            "--format",
+            "json",
+        ]
+
+        direct = subprocess.run(
+            [self.inspector_path, verilog_file, new_macro_file, *queries],
+            check=True,
+            stdout=subprocess.PIPE,
+            text=True,
+        )
+        expected = json.loads(direct.stdout)
+        self.assertEqual(expected["NEW_MACRO"]["definition"]["name"], "NEW_MACRO")
+        self.assertEqual(
+            expected["OLD_MACRO"]["instances"][0]["instanceName"], "u_inst"
+        )
+
+        with tempfile.TemporaryDirectory() as tmp:
+            filelist = os.path.join(tmp, "design.f")
+            with open(filelist, "w") as f:
+                f.write(f"{verilog_file}\n{new_macro_file}\n")
+
+            # Sources from a filelist, parsed on one or several threads, give the same
+            # answer.
+            for threads in ("1", "4"):
+                cmd = [self.inspector_path, "-f", filelist, "--threads", threads]
+                proc = subprocess.run(
+                    cmd + queries,
+                    check=True,
+                    stdout=subprocess.PIPE,
+                    text=True,
+                )
+                self.assertEqual(json.loads(proc.stdout), expected)
+
+    def test_legacy_form(self):
+        verilog_file = os.path.join(self.case1_dir, "top_module.sv")
+        # inspector <verilog_file> <module_name> still answers the named module.
+        proc = subprocess.run(
+            [self.inspector_path, verilog_file, "top_module", "--format", "json"],
+            check=True,
+            stdout=subprocess.PIPE,
+            text=True,
+        )
+        self.assertEqual(json.loads(proc.stdout)["definition"]["name"], "top_module")
+
+        # A missing second source is reported, not taken as a module name.
+        for missing in ("b_typo.v", "missing_top"):
+            cmd = [self.inspector_path, verilog_file, missing, "--query", "OLD_MACRO"]
+            proc = subprocess.run(
+                cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True
+            )
+            self.assertNotEqual(proc.returncode, 0, missing)
+            self.assertIn(missing, proc.stderr)
+
+    def test_parallel_collection(self):
+        # Three levels, fan-out 4, a blackbox and two defined cells in every leaf: the
+        # parallel walk splits the hierarchy into many subtrees.
+        lines = ["module cell (input A, output Z); endmodule"]
+        lines.append(
+            "module leaf; wire a, z; OLD_MACRO u_ram (.CLK(a), .Q(z));"
+            " cell u_c0 (.A(a), .Z(z)); cell u_c1 (.A(z), .Z(a)); endmodule"
+        )
+        for level, child in (("mid", "leaf"), ("top", "mid")):
+            insts = " ".join(f"{child} u_{child}{i} ();" for i in range(4))
+            lines.append(f"module {level}; {insts} endmodule")
+
+        with tempfile.TemporaryDirectory() as tmp:
+            verilog_file = os.path.join(tmp, "top.sv")
+            with open(verilog_file, "w") as f:
+                f.write("\n".join(lines) + "\n")
+
+            cmd = [self.inspector_path, verilog_file, "--format", "json"]
+            for query in ("OLD_MACRO", "cell", "l*", "mid"):
+                cmd += ["--query", query]
+            outputs = [
+                subprocess.run(
+                    cmd + ["--threads", threads],
+                    check=True,
+                    stdout=subprocess.PIPE,
+                    text=True,
+                ).stdout
+                for threads in ("1", "4", "0")
+            ]
+
+        serial = json.loads(outputs[0])
+        self.assertEqual(len(serial["OLD_MACRO"]["instances"]), 16)
+        self.assertEqual(len(serial["cell"]["instances"]), 32)
+        # Same results in the same order, whatever the number of workers.
+        for output in outputs[1:]:
+            self.assertEqual(json.loads(output), serial)
+
+    def test_glob_directions(self):
+        design = """
+        module top; wire w; mac_a u_a (.A(w)); mac_b u_b (.A(w)); endmodule
+        module mac_a (output A); endmodule
+        """
+        with tempfile.TemporaryDirectory() as tmp:
+            verilog_file = os.path.join(tmp, "top.sv")
+            with open(verilog_file, "w") as f:
+                f.write(design)
+
+            cmd = [self.inspector_path, verilog_file, "--query", "mac_*"]
+            proc = subprocess.run(
+                cmd + ["--format", "json"], stdout=subprocess.PIPE, text=True
+            )
+            result = json.loads(proc.stdout)["mac_*"]
+            self.assertEqual(result["definition"]["name"], "mac_a")
+            directions = {
+                inst["instanceName"]: inst["connections"][0]["direction"]
+                for inst in result["instances"]
+            }
+            # The blackbox mac_b does not borrow the ports of mac_a.
+            self.assertEqual(directions, {"u_a": "Output", "u_b": "Unknown"})
+
+    def test_manifest(self):
+        case2_dir = os.path.join(self.base_dir, "test_cases/case2")
+        case2_output = os.path.join(case2_dir, "output.sv")
+        manifest = os.path.join(self.case1_dir, "manifest.json")
+        jobs = [
+            {
+                "verilog": "top_module.sv",
+                "module": "top_module",
+                "old_macro": "OLD_MACRO",
+                "new_macro_file": "new_macro.v",
+                "new_macro_name": "NEW_MACRO",
+                "out": "output.sv",
+            },
+            {
+                "verilog": "../case2/top.sv",
+                "module": "top",
+                "old_macro": "OLD_MACRO",
+                "new_macro_file": "../case2/new_macro.v",
+                "new_macro_name": "NEW_MACRO",
+                "out": "../case2/output.sv",
+            },
+        ]
+        with open(manifest, "w") as f:
+            json.dump(jobs, f)
+
+        try:
+            argv = ["replacer.py", "--manifest", manifest, "--jobs", "2"]
+            with mock.patch("sys.argv", argv):
+                replacer.main()
+
+            with open(self.output_file, "r") as f:
+                content = f.read()
+            self.assertIn("NEW_MACRO u_inst", content)
+            self.assertIn(".WEN        (wen)", content)
+
+            with open(case2_output, "r") as f:
+                content = f.read()
+            self.assertIn("NEW_MACRO u_inst", content)
+            self.assertIn(".X          (/* UNCONNECTED */)", content)
+        finally:
+            for path in (manifest, case2_output):
+                if os.path.exists(path):
+                    os.remove(path)
+
+    def test_liberty(self):
+        verilog_file = os.path.join(self.case1_dir, "top_module.sv")
+        liberty = """
+        library (macros) {
+          type (bus4) { bit_width : 4; bit_from : 3; bit_to : 0; }
+          cell (OLD_MACRO) {
+            pin (CLK) { direction : input; clock : true; }
+            pin (CW) { direction : input; }
+            bus (D) { bus_type : bus4; direction : input; }
+            bus (Q) { bus_type : bus4; direction : output; }
+          }
+        }
+        """
+        with tempfile.TemporaryDirectory() as tmp:
+            lib_file = os.path.join(tmp, "macros.lib")
+            with open(lib_file, "w") as f:
+                f.write(liberty)
+
+            cmd = [
+                self.inspector_path,
+                verilog_file,
+                "--query",
+                "OLD_MACRO",
+                "--liberty",
+                lib_file,
+                "--format",
+                "json",
+            ]
+            cache_home = os.path.join(tmp, "cache")
+            env = dict(os.environ, XDG_CACHE_HOME=cache_home)
+            index_dir = os.path.join(cache_home, "slang-inspector")
+            # The second run of each maps the index built by the first. By default the
+            # index goes to the user's cache, never beside the library.
+            beside_flag = ["--liberty-index-beside"]
+            for extra in ([], [], beside_flag, beside_flag):
+                proc = subprocess.run(
+                    cmd + extra,
+                    check=True,
+                    stdout=subprocess.PIPE,
+                    text=True,
+                    env=env,
+                )
+                result = json.loads(proc.stdout)["OLD_MACRO"]
+                directions = {
+                    conn["portName"]: conn["direction"]
+                    for conn in result["instances"][0]["connections"]
+                }
+                self.assertEqual(
+                    directions,
+                    {"CLK": "Input", "CW": "Input", "D": "Input", "Q": "Output"},
+                )
+                beside = os.path.exists(lib_file + ".pinidx")
+                self.assertEqual(beside, bool(extra))
+            self.assertEqual(len(os.listdir(index_dir)), 1)
+
+    def test_liberty_widths(self):
+        # An undeclared net leaves only the liberty pin to give the width, which both
+        # modes must report in the same form.
+        design = """
+        `default_nettype none
+        module top;
+          OLD_MACRO u_inst (.D(data));
+        endmodule
+        """
+        liberty = """
+        library (macros) {
+          type (bus4) { bit_width : 4; bit_from : 3; bit_to : 0; }
+          cell (OLD_MACRO) {
+            bus (D) { bus_type : bus4; direction : input; }
+          }
+        }
+        """
+        with tempfile.TemporaryDirectory() as tmp:
+            verilog_file = os.path.join(tmp, "top.sv")
+            lib_file = os.path.join(tmp, "macros.lib")
+            with open(verilog_file, "w") as f:
+                f.write(design)
+            with open(lib_file, "w") as f:
+                f.write(liberty)
+
+            cmd = [
+                self.inspector_path,
+                verilog_file,
+                "--query",
+                "OLD_MACRO",
+                "--liberty",
+                lib_file,
+                "--format",
+                "json",
+            ]
+            env = dict(os.environ, XDG_CACHE_HOME=os.path.join(tmp, "cache"))
+            for extra in ([], ["--syntax-only"]):
+                proc = subprocess.run(
+                    cmd + extra, check=True, stdout=subprocess.PIPE, text=True, env=env
+                )
+                result = json.loads(proc.stdout)["OLD_MACRO"]
+                conn = result["instances"][0]["connections"][0]
+                self.assertEqual(conn["portName"], "D")
+                self.assertEqual(conn["width"], "4 (from liberty)", extra)
+
+    def test_cache(self):
+        with tempfile.TemporaryDirectory() as tmp:
+            cache_dir = os.path.join(tmp, "cache")
+            stats = os.path.join(tmp, "stats.json")
+            for sub in ("a", "b"):
+                os.makedirs(os.path.join(tmp, sub))
+                with open(os.path.join(tmp, sub, "top.sv"), "w") as f:
+                    f.write(f"module top; OLD_MACRO u_{sub} (.CLK(1'b0)); endmodule\n")
+
+            def run(cwd, *args):
+                """Instance names found, and whether the result came from the cache."""
+                cmd = [self.inspector_path, *args, "--query", "OLD_MACRO"]
+                cmd += ["--format", "json", "--cache-dir", cache_dir]
+                proc = subprocess.run(
+                    cmd + [f"--stats={stats}"],
+                    cwd=cwd,
+                    check=True,
+                    stdout=subprocess.PIPE,
+                    text=True,
+                )
+                doc = json.loads(proc.stdout)
+                if "--compact" in args:
+                    doc = CompactResults(doc).expand()
+                with open(stats, "r") as f:
+                    phases = {phase["name"] for phase in json.load(f)["phases"]}
+                names = [inst["instanceName"] for inst in doc["OLD_MACRO"]["instances"]]
+                # A cache hit never parses the sources.
+                return names, "parse" not in phases
+
+            a_dir, b_dir = os.path.join(tmp, "a"), os.path.join(tmp, "b")
+            self.assertEqual(run(a_dir, "top.sv"), (["u_a"], False))
+            self.assertEqual(run(a_dir, "top.sv"), (["u_a"], True))
+            # The same relative path in another directory is another design.
+            self.assertEqual(run(b_dir, "top.sv"), (["u_b"], False))
+
+            # Output-only flags are left out of the key without swallowing the next
+            # argument.
+            a_file = os.path.join(a_dir, "top.sv")
+            b_file = os.path.join(b_dir, "top.sv")
+            self.assertEqual(run(tmp, "--compact", a_file), (["u_a"], True))
+            self.assertEqual(run(tmp, "--compact", b_file), (["u_b"], True))
+            self.assertEqual(run(tmp, "--report-rss", a_file), (["u_a"], True))
+            self.assertEqual(run(tmp, "-j8", a_file), (["u_a"], True))
+
+            # Editing a source invalidates its entries.
+            with open(a_file, "w") as f:
+                f.write("module top; OLD_MACRO u_edited (.CLK(1'b0)); endmodule\n")
+            self.assertEqual(run(a_dir, "top.sv"), (["u_edited"], False))
+            self.assertEqual(run(tmp, a_file), (["u_edited"], True))
+
+    def test_stats(self):
+        verilog_file = os.path.join(self.case1_dir, "top_module.sv")
+        query = ["--query", "OLD_MACRO", "--format", "json"]
+        with tempfile.TemporaryDirectory() as tmp:
+            stats = os.path.join(tmp, "stats.json")
+            # The file given after --stats is its report, not another source.
+            for args in (
+                ["--stats", stats, verilog_file, *query],
+                [f"--stats={stats}", verilog_file, *query],
+            ):
+                proc = subprocess.run(
+                    [self.inspector_path, *args],
+                    check=True,
+                    stdout=subprocess.PIPE,
+                    text=True,
+                )
+                self.assertIn("OLD_MACRO", json.loads(proc.stdout))
+                with open(stats, "r") as f:
+                    self.assertIn("phases", json.load(f))
+                os.remove(stats)
+
+        # Without a file, or with "-", the report goes to stderr.
+        for args in (
+            [verilog_file, *query, "--stats"],
+            [verilog_file, "--stats", *query],
+            [verilog_file, "--stats", "-", *query],
+            [verilog_file, "--stats=-", *query],
+        ):
+            proc = subprocess.run(
+                [self.inspector_path, *args],
+                check=True,
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+                text=True,
+            )
+            self.assertIn("OLD_MACRO", json.loads(proc.stdout))
+            self.assertIn('"phases"', proc.stderr, args)
+
+    def test_fields(self):
+        design = """
+        module child(input a, output [1:0] b); endmodule
+        module top; wire x; wire [1:0] y; child u_c (.a(x), .b(y)); endmodule
+        """
+        with tempfile.TemporaryDirectory() as tmp:
+            verilog_file = os.path.join(tmp, "top.sv")
+            with open(verilog_file, "w") as f:
+                f.write(design)
+
+            def run(*args):
+                cmd = [self.inspector_path, verilog_file, "--query", "child"]
+                proc = subprocess.run(
+                    [*cmd, "--format", "json", *args],
+                    check=True,
+                    stdout=subprocess.PIPE,
+                    text=True,
+                )
+                return json.loads(proc.stdout)["child"]
+
+            full = run()
+            projected = run("--fields", "name,direction")
+            paths_only = run("--fields", "path")
+
+            # The syntax-only collector has no projection; the combination is refused.
+            cmd = [self.inspector_path, verilog_file, "--query", "child"]
+            proc = subprocess.run(
+                cmd + ["--syntax-only", "--fields", "name,offsets"],
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+            )
+            self.assertNotEqual(proc.returncode, 0)
+
+        # Requested fields match the full result; the others keep their empty defaults.
+        ports = projected["definition"]["ports"]
+        self.assertEqual(
+            [(p["name"], p["direction"], p["type"]) for p in ports],
+            [(p["name"], p["direction"], "") for p in full["definition"]["ports"]],
+        )
+        inst = projected["instances"][0]
+        self.assertEqual(inst["instanceName"], "u_c")
+        self.assertEqual(inst["fullPath"], "")
+        self.assertEqual(inst["definitionName"], "")
+        self.assertEqual((inst["startOffset"], inst["endOffset"]), (0, 0))
+        self.assertEqual(full["instances"][0]["fullPath"], "top.u_c")
+        self.assertEqual(
+            [(c["portName"], c["direction"]) for c in inst["connections"]],
+            [("a", "Input"), ("b", "Output")],
+        )
+        for conn in inst["connections"]:
+            self.assertEqual((conn["signalType"], conn["width"]), ("", ""))
+        for port in paths_only["definition"]["ports"]:
+            self.assertEqual((port["name"], port["direction"]), ("", ""))
+        self.assertEqual(paths_only["instances"][0]["fullPath"], "top.u_c")
+
+    def test_definitions_only(self):
+        design = """
+        module top; mid u_mid0(); mid u_mid1(); endmodule
+        module mid; leaf u_leaf(); endmodule
+        module leaf(input a, output [1:0] b); endmodule
+        """
+        with tempfile.TemporaryDirectory() as tmp:
+            verilog_file = os.path.join(tmp, "top.sv")
+            stats = os.path.join(tmp, "stats.json")
+            with open(verilog_file, "w") as f:
+                f.write(design)
+
+            def run(*args):
+                cmd = [self.inspector_path, verilog_file, "--query", "leaf"]
+                cmd += ["--query", "mid", "--format", "json", f"--stats={stats}"]
+                proc = subprocess.run(
+                    [*cmd, *args], check=True, stdout=subprocess.PIPE, text=True
+                )
+                with open(stats, "r") as f:
+                    counters = json.load(f)["counters"]
+                return json.loads(proc.stdout), counters
+
+            full, full_counters = run()
+            defs, defs_counters = run("--definitions-only")
+
+        # Child paths differ: the walk describes mid from top.u_mid0, the definition
+        # table from a default instance.
+        for query in ("leaf", "mid"):
+            definition, expected = defs[query]["definition"], full[query]["definition"]
+            self.assertEqual(definition["ports"], expected["ports"])
+            self.assertEqual(
+                [inst["instanceName"] for inst in definition["instances"]],
+                [inst["instanceName"] for inst in expected["instances"]],
+            )
+            self.assertEqual(defs[query]["instances"], [])
+        self.assertEqual(len(full["leaf"]["instances"]), 2)
+        # The hierarchy was never walked.
+        self.assertIn("instancesVisited", full_counters)
+        self.assertNotIn("instancesVisited", defs_counters)
+
+    def test_scope(self):
+        design = """
+        module chip; mem_sys u_mem(); cpu u_cpu(); endmodule
+        module mem_sys; bank u_bank0(); bank u_bank1(); endmodule
+        module bank; OLD_MACRO u_ram (.CLK(1'b0)); endmodule
+        module cpu; OLD_MACRO u_rf (.CLK(1'b0)); endmodule
+        """
+        with tempfile.TemporaryDirectory() as tmp:
+            verilog_file = os.path.join(tmp, "chip.sv")
+            with open(verilog_file, "w") as f:
+                f.write(design)
+
+            cmd = [
+                self.inspector_path,
+                verilog_file,
+                "--top",
+                "chip",
+                "--query",
+                "OLD_MACRO",
+                "--query",
+                "bank",
+                "--format",
+                "json",
+            ]
+            proc = subprocess.run(
+                cmd + ["--scope", "chip.u_mem"],
+                check=True,
+                stdout=subprocess.PIPE,
+                text=True,
+            )
+            result = json.loads(proc.stdout)
+            self.assertEqual(
+                [inst["fullPath"] for inst in result["OLD_MACRO"]["instances"]],
+                ["chip.u_mem.u_bank0.u_ram", "chip.u_mem.u_bank1.u_ram"],
+            )
+            # A definition below the top is found without a scope too.
+            self.assertEqual(result["bank"]["definition"]["name"], "bank")
+            proc = subprocess.run(cmd, check=True, stdout=subprocess.PIPE, text=True)
+            self.assertEqual(
+                json.loads(proc.stdout)["bank"]["definition"],
+                result["bank"]["definition"],
+            )
+
+            proc = subprocess.run(
+                cmd + ["--scope", "chip.u_nope"],
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+            )
+            self.assertNotEqual(proc.returncode, 0)
+
+    def test_ndjson(self):
+        verilog_file = os.path.join(self.case1_dir, "top_module.sv")
+        cmd = [
+            self.inspector_path,
+            verilog_file,
+            "--query",
+            "top_module",
+            "--query",
+            "OLD_MACRO",
+        ]
+        regular = subprocess.run(
+            cmd + ["--format", "json"], check=True, stdout=subprocess.PIPE, text=True
+        )
+        expected = json.loads(regular.stdout)
+        stream = subprocess.run(
+            cmd + ["--format", "ndjson"], check=True, stdout=subprocess.PIPE, text=True
+        )
+        lines = [json.loads(line) for line in stream.stdout.splitlines()]
+
+        # Definition lines come first, then one line per instance; each names its query.
+        kinds = ["definition" in line for line in lines]
+        self.assertEqual(kinds, sorted(kinds, reverse=True))
+        results = {query: {"definition": None, "instances": []} for query in expected}
+        for line in lines:
+            result = results[line.pop("query")]
+            if "definition" in line:
+                result["definition"] = line["definition"]
+            else:
+                result["instances"].append(line)
+        self.assertEqual(results, expected)
+        self.assertEqual(results["OLD_MACRO"]["instances"][0]["instanceName"], "u_inst")
+
+    def test_compact(self):
+        verilog_file = os.path.join(self.case1_dir, "top_module.sv")
+        cmd = [
+            self.inspector_path,
+            verilog_file,
+            "--query",
+            "top_module",
+            "--query",
+            "OLD_MACRO",
+            "--format",
+            "json",
+        ]
+        regular = subprocess.run(cmd, check=True, stdout=subprocess.PIPE, text=True)
+        compact = subprocess.run(
+            cmd + ["--compact"], check=True, stdout=subprocess.PIPE, text=True
+        )
+
+        results = CompactResults(json.loads(compact.stdout))
+        self.assertEqual(results.expand(), json.loads(regular.stdout))
+
+    def test_python_module(self):
+        module = replacer._inspector_module()
+        if module is None:
+            self.skipTest(
+                "slang_inspector module not built (-DINSPECTOR_BUILD_PYTHON=ON)"
+            )
+
+        verilog_file = os.path.join(self.case1_dir, "top_module.sv")
+        queries = ["top_module", "OLD_MACRO"]
+        in_process = replacer.run_inspector_queries([verilog_file], queries)
+        with mock.patch.dict(os.environ, {"MACRO_REPLACER_INSPECTOR": "exe"}):
+            replacer._inspector_module.cache_clear()
+            try:
+                executable = replacer.run_inspector_queries([verilog_file], queries)
+            finally:
+                replacer._inspector_module.cache_clear()
+        self.assertEqual(in_process, executable)
+
+        design = module.Design([verilog_file])
+        result = design.inspect("OLD_MACRO")
+        self.assertEqual(result.to_dict(), executable["OLD_MACRO"])
+        self.assertEqual(result.instances[0].definition_name, "OLD_MACRO")
+
+    def test_serve(self):
+        verilog_file = os.path.join(self.case1_dir, "top_module.sv")
+        proc = subprocess.Popen(
+            [self.inspector_path, verilog_file, "--serve"],
+            stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+            text=True,
+        )
+        requests = [
+            {
+                "jsonrpc": "2.0",
+                "id": 1,
+                "method": "definition",
+                "params": {"module": "top_module"},
+            },
+            {
+                "jsonrpc": "2.0",
+                "id": 2,
+                "method": "instances",
+                "params": {"module": "OLD_MACRO"},
+            },
+            {
+                "jsonrpc": "2.0",
+                "id": 3,
+                "method": "inspect",
+                "params": {"queries": "OLD_MACRO"},
+            },
+            {"jsonrpc": "2.0", "id": 4, "method": "shutdown"},
+        ]
+        out, _ = proc.communicate("\n".join(json.dumps(r) for r in requests) + "\n")
+        responses = [json.loads(line) for line in out.splitlines()]
+
+        self.assertEqual([r["id"] for r in responses], [1, 2, 3, 4])
+        self.assertEqual(responses[0]["result"]["name"], "top_module")
+        self.assertEqual(responses[1]["result"][0]["instanceName"], "u_inst")
+        self.assertEqual(responses[2]["error"]["code"], -32602)
+        self.assertTrue(responses[3]["result"])
+
+    def test_serve_filelist_reload(self):
+        new_macro_file = os.path.join(self.case1_dir, "new_macro.v")
+        with tempfile.TemporaryDirectory() as tmp:
+            filelist = os.path.join(tmp, "design.f")
+            with open(filelist, "w") as f:
+                f.write(os.path.join(self.case1_dir, "top_module.sv") + "\n")
+
+            proc = subprocess.Popen(
+                [self.inspector_path, "-f", filelist, "--serve"],
+                stdin=subprocess.PIPE,
+                stdout=subprocess.PIPE,
+                text=True,
+            )
+
+            def request(request_id, method, params=None):
+                line = {"jsonrpc": "2.0", "id": request_id, "method": method}
+                if params is not None:
+                    line["params"] = params
+                proc.stdin.write(json.dumps(line) + "\n")
+                proc.stdin.flush()
+                return json.loads(proc.stdout.readline())
+
+            try:
+                params = {"module": "NEW_MACRO"}
+                self.assertIsNone(request(1, "definition", params)["result"])
+                # Adding a source to the filelist is noticed like an edited source.
+                with open(filelist, "a") as f:
+                    f.write(new_macro_file + "\n")
+                result = request(2, "definition", params)["result"]
+                self.assertEqual(result["name"], "NEW_MACRO")
+                self.assertTrue(request(3, "shutdown")["result"])
+            finally:
+                proc.stdin.close()
+                proc.wait()
+
+    def test_serve_socket_disconnect(self):
+        verilog_file = os.path.join(self.case1_dir, "top_module.sv")
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, "inspector.sock")
+            proc = subprocess.Popen(
+                [self.inspector_path, verilog_file, "--serve", "--socket", path],
+                stderr=subprocess.DEVNULL,
+            )
+            try:
+                for _ in range(300):
+                    if os.path.exists(path):
+                        break
+                    time.sleep(0.1)
+
+                request = {
+                    "jsonrpc": "2.0",
+                    "id": 1,
+                    "method": "inspect",
+                    "params": {"module": "OLD_MACRO"},
+                }
+                # The first client hangs up without reading its reply.
+                for _ in range(3):
+                    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as client:
+                        client.connect(path)
+                        client.sendall((json.dumps(request) + "\n").encode())
+
+                with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as client:
+                    client.connect(path)
+                    client.sendall((json.dumps(request) + "\n").encode())
+                    reply = client.makefile("r").readline()
+                instances = json.loads(reply)["result"]["instances"]
+                self.assertEqual(instances[0]["instanceName"], "u_inst")
+                self.assertIsNone(proc.poll())
+            finally:
+                proc.kill()
+                proc.wait()
+
 
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,95 @@
+import os
+import sys
+import unittest
+
+# Add src to path
+sys.path.insert(
+    0, os.path.abspath(os.path.join(os.path.dirname(__file__), "../../src"))
+)
+
+from macro_replacer.compact import CompactResults
+
+
+def compact_doc(multi_query=False):
+    return {
+        "format": "inspector-compact",
+        "version": 1,
+        "multiQuery": multi_query,
+        "queries": ["MACRO"],
+        "strings": [
+            "top",
+            "u_a[0]",
+            "u_m",
+            "MACRO",
+            "CLK",
+            "logic",
+            "1",
+            "Input",
+            "u_a[1]",
+            "\\esc.aped ",
+            "x",
+            "odd",
+        ],
+        "nodes": [[-1, 0], [0, 1], [1, 2], [0, 8], [3, 2], [0, 9], [5, 10]],
+        "connectionSets": [[[4, 5, 6, 7, True]], []],
+        "results": [
+            {
+                "definition": None,
+                "instances": [
+                    [2, -1, 3, 0, 10, 20],
+                    [4, -1, 3, 0, 30, 40],
+                    [6, 11, 3, 1, 1, 2],
+                    [-1, 11, 3, 1, 0, 0],
+                ],
+            }
+        ],
+    }
+
+
+class TestCompactResults(unittest.TestCase):
+    def test_expand(self):
+        result = CompactResults(compact_doc()).expand()
+
+        self.assertIsNone(result["definition"])
+        first = result["instances"][0]
+        self.assertEqual(
+            first,
+            {
+                "instanceName": "u_m",
+                "fullPath": "top.u_a[0].u_m",
+                "definitionName": "MACRO",
+                "connections": [
+                    {
+                        "portName": "CLK",
+                        "signalType": "logic",
+                        "width": "1",
+                        "direction": "Input",
+                        "isConnected": True,
+                    }
+                ],
+                "startOffset": 10,
+                "endOffset": 20,
+            },
+        )
+        self.assertEqual(
+            [(i["instanceName"], i["fullPath"]) for i in result["instances"][1:]],
+            [("u_m", "top.u_a[1].u_m"), ("odd", "top.\\esc.aped .x"), ("odd", "")],
+        )
+        # Shared connection lists expand to equal but independent lists.
+        self.assertIsNot(first["connections"], result["instances"][1]["connections"])
+
+    def test_multi_query_and_lazy_paths(self):
+        results = CompactResults(compact_doc(multi_query=True))
+        self.assertEqual(list(results.expand()), ["MACRO"])
+
+        results = CompactResults(compact_doc())
+        self.assertEqual(results.path(4), "top.u_a[1].u_m")
+        self.assertEqual(sorted(results._paths), [0, 3, 4])
+
+    def test_rejects_other_documents(self):
+        with self.assertRaises(ValueError):
+            CompactResults({"definition": None, "instances": []})
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,108 @@
+import json
+import os
+import sys
+import tempfile
+import unittest
+
+# Add src to path
+sys.path.insert(
+    0, os.path.abspath(os.path.join(os.path.dirname(__file__), "../../src"))
+)
+
+from macro_replacer.portmap import PortMapper, PortRuleError
+
+
+class TestPortMapper(unittest.TestCase):
+    def test_default_rules(self):
+        # Same answers as the original heuristics for the case1 macro.
+        old = ["CLK", "CW", "D", "Q", "BWEN"]
+        new = ["CLK", "WEN", "D", "Q", "BWEB", "CEN"]
+        result = PortMapper().map(old, new)
+
+        self.assertEqual(
+            result.pairs,
+            [
+                ("CLK", "CLK"),
+                ("WEN", "CW"),
+                ("D", "D"),
+                ("Q", "Q"),
+                ("BWEB", "BWEN"),
+                ("CEN", None),
+            ],
+        )
+        self.assertEqual(result.unmapped, ["CEN"])
+        self.assertEqual(result.unused, [])
+
+    def test_normalized_and_clock(self):
+        result = PortMapper().map(["clk_i", "Data_In"], ["CLKA", "DATAIN"])
+        self.assertEqual(result.pairs, [("CLKA", None), ("DATAIN", "Data_In")])
+
+        result = PortMapper().map(["CLK"], ["CLKA"])
+        self.assertEqual(result.pairs, [("CLKA", "CLK")])
+
+    def test_ambiguous(self):
+        result = PortMapper().map(["A_B", "AB"], ["ab"])
+        self.assertEqual(result.pairs, [("ab", None)])
+        self.assertEqual(
+            result.ambiguous, [{"port": "ab", "rule": 1, "candidates": ["A_B", "AB"]}]
+        )
+        self.assertEqual(result.unused, ["A_B", "AB"])
+
+    def test_bus_rewrite(self):
+        mapper = PortMapper(
+            {
+                "rules": [
+                    {"type": "bus", "new": "Q_{i}", "old": "Q[{i}]"},
+                    {"type": "bus", "new": "A{i}", "old": "ADDR[{i}]", "offset": -1},
+                ]
+            }
+        )
+        old = [f"Q[{i}]" for i in range(1024)] + ["ADDR[0]", "ADDR[1]"]
+        new = [f"Q_{i}" for i in range(1024)] + ["A1", "A2", "A3"]
+        result = mapper.map(old, new)
+
+        self.assertEqual(result.pairs[511], ("Q_511", "Q[511]"))
+        self.assertEqual(
+            result.pairs[-3:], [("A1", "ADDR[0]"), ("A2", "ADDR[1]"), ("A3", None)]
+        )
+        self.assertEqual(result.unmapped, ["A3"])
+        self.assertEqual(result.unused, [])
+
+    def test_regex_and_rule_order(self):
+        mapper = PortMapper(
+            {
+                "rules": [
+                    {"type": "exact", "map": {"WEB": "WE_N"}},
+                    {"type": "regex", "new": r"DOUT(\d+)", "old": [r"Q\1", r"DO\1"]},
+                ]
+            }
+        )
+        result = mapper.map(["WE_N", "DO3", "Q4", "DO4"], ["WEB", "DOUT3", "DOUT4"])
+        self.assertEqual(
+            result.pairs, [("WEB", "WE_N"), ("DOUT3", "DO3"), ("DOUT4", "Q4")]
+        )
+        self.assertEqual(result.unused, ["DO4"])
+        self.assertEqual(
+            result.to_dict()["mapped"]["DOUT3"], {"old": "DO3", "rule": 1}
+        )
+
+    def test_rule_file(self):
+        with tempfile.NamedTemporaryFile("w", suffix=".json", delete=False) as f:
+            json.dump({"rules": [{"type": "normalized"}]}, f)
+        try:
+            result = PortMapper.from_file(f.name).map(["WEN"], ["W_EN"])
+            self.assertEqual(result.pairs, [("W_EN", "WEN")])
+        finally:
+            os.remove(f.name)
+
+    def test_bad_rules(self):
+        with self.assertRaises(PortRuleError):
+            PortMapper({"rules": [{"type": "fuzzy"}]})
+        with self.assertRaises(PortRuleError):
+            PortMapper({"rules": [{"type": "bus", "new": "Q_", "old": "Q[{i}]"}]})
+        with self.assertRaises(PortRuleError):
+            PortMapper({"rules": [{"type": "regex", "new": "(", "old": "x"}]})
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,94 @@
+import os
+import sys
+import tempfile
+import unittest
+from unittest import mock
+
+# Add src to path
+sys.path.insert(
+    0, os.path.abspath(os.path.join(os.path.dirname(__file__), "../../src"))
+)
+
+from macro_replacer import replacer
+
+
+class TestWriteWithEdits(unittest.TestCase):
+    def test_applies_edits_from_mapping(self):
+        with tempfile.TemporaryDirectory() as tmp:
+            source = os.path.join(tmp, "top.sv")
+            out_file = os.path.join(tmp, "out.sv")
+            with open(source, "wb") as f:
+                f.write(b"module top; OLD u (); endmodule\n")
+
+            with replacer.open_source(source) as content:
+                replacer.write_with_edits(content, [(12, 15, "NEW")], out_file)
+            with open(out_file, "rb") as f:
+                self.assertEqual(f.read(), b"module top; NEW u (); endmodule\n")
+
+    def test_write_error_is_not_masked(self):
+        with tempfile.TemporaryDirectory() as tmp:
+            source = os.path.join(tmp, "top.sv")
+            with open(source, "wb") as f:
+                f.write(b"module top; endmodule\n")
+
+            # Closing the mapping must not fail with BufferError over a live view.
+            out_file = os.path.join(tmp, "missing", "out.sv")
+            with self.assertRaises(FileNotFoundError):
+                with replacer.open_source(source) as content:
+                    replacer.write_with_edits(content, [], out_file)
+
+
+class FakeResult:
+    definition = {"name": "M"}
+    instances = []
+
+    def to_dict(self):
+        return {"definition": self.definition, "instances": self.instances}
+
+
+class FakeModule:
+    def __init__(self):
+        self.loaded = []
+        module = self
+
+        class Design:
+            def __init__(self, files):
+                module.loaded.append(tuple(files))
+
+            def query(self, names, instances=True):
+                return [FakeResult() for _ in names]
+
+        self.Design = Design
+
+
+class TestDesignCache(unittest.TestCase):
+    def setUp(self):
+        self.module = FakeModule()
+        patcher = mock.patch.object(
+            replacer, "_inspector_module", return_value=self.module
+        )
+        patcher.start()
+        self.addCleanup(patcher.stop)
+        self.addCleanup(replacer._designs.clear)
+        replacer._designs.clear()
+
+    def query(self, path):
+        self.assertIsNotNone(replacer._query_in_process([path], ["M"]))
+
+    def test_reuses_loaded_design(self):
+        self.query("a.sv")
+        self.query("a.sv")
+        self.assertEqual(self.module.loaded, [("a.sv",)])
+
+    def test_evicts_least_recently_used(self):
+        for path in ("a.sv", "b.sv", "a.sv", "c.sv", "a.sv", "b.sv"):
+            self.query(path)
+        # c.sv pushed out b.sv, the least recently used; a.sv stayed loaded.
+        self.assertEqual(
+            self.module.loaded, [("a.sv",), ("b.sv",), ("c.sv",), ("b.sv",)]
+        )
+        self.assertLessEqual(len(replacer._designs), replacer._MAX_DESIGNS)
+
+
+if __name__ == "__main__":
+    unittest.main()